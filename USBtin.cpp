@@ -25,16 +25,183 @@ this source code.
 #include <string.h>
 
 #include "USBtin.h"
+#include "UT_lpc17xx.h"
 
 CAN USBTIN_CANport0(USBTIN_CAN_RX, USBTIN_CAN_TX);
-CAN *USBTIN_CANport = &USBTIN_CANport0;
 
-Serial USBTIN_serialPort0(USBTIN_SERIAL_TX, USBTIN_SERIAL_RX);
-Serial *USBTIN_serialPort = &USBTIN_serialPort0;
+#if (USBTIN_CHANNELS > 1)
+CAN USBTIN_CANport1(USBTIN_CH1_RX, USBTIN_CH1_TX);
+#endif
 
-extern unsigned char deviceState;
+channel_t USBTIN_channels[USBTIN_CHANNELS] = {
+    { &USBTIN_CANport0, USBTIN_CAN_REGS, USBTIN_CAN, 0 },
+#if (USBTIN_CHANNELS > 1)
+    { &USBTIN_CANport1, USBTIN_CH1_REGS, 1 - USBTIN_CAN, 0 },
+#endif
+};
+
+#if (USBTIN_TRANSPORT == TRANSPORT_USBCDC)
+UT_USBSerial USBTIN_serialPort0;
+#else
+UT_Serial USBTIN_serialPort0(USBTIN_SERIAL_TX, USBTIN_SERIAL_RX);
+#endif
+UT_Transport *USBTIN_serialPort = &USBTIN_serialPort0;
+
+UT_LpcCan USBTIN_can;
+UT_MbedClock USBTIN_clock;
+
+// large engine buffers, one AHB SRAM bank each
+static device_bulk0_t USBTIN_bulk0 PORT_BULK0;
+static device_bulk1_t USBTIN_bulk1 PORT_BULK1;
+
+UT_LpcEngine USBTIN_engine(USBTIN_can, USBTIN_serialPort0, USBTIN_clock,
+    USBTIN_bulk0, USBTIN_bulk1);
+
+Ticker UT_ticker;
+
+/**
+ * Read the receive buffer of given controller and release it.
+ * Bypasses the mbed driver, which locks and converts on every frame.
+ *
+ * @param can Controller registers
+ * @param canmsg Output can message, timestamp is not set
+ * @return 1 if a frame was read, 0 if the buffer is empty
+ */
+static inline unsigned char readFrame(LPC_CAN_TypeDef * can, canmsg_t * canmsg) {
+    if (!(can->GSR & CAN_GSR_RBS))
+        return 0;
+
+    uint32_t rfs = can->RFS;
+    uint32_t data[2] = { can->RDA, can->RDB };
+
+    canmsg->id = can->RID;
+    canmsg->extended = (rfs & CAN_RFS_FF) != 0;
+    canmsg->rtr = (rfs & CAN_RFS_RTR) != 0;
+    canmsg->dlc = CAN_RFS_DLC(rfs);
+    // the payload is word aligned and both sides are little endian
+    memcpy(canmsg->data, data, 8);
+
+    can->CMR = CAN_CMR_RRB;
+    return 1;
+}
+
+/**
+ * CAN receive interrupt handler.
+ * Both controllers share one interrupt, so all channels are served.
+ * Messages lost in the controller are counted as overrun.
+ */
+void UT_canRxIsr(void) {
+    unsigned long timestamp = USBTIN_engine.rxTimestamp();
+    unsigned char channel;
+    canmsg_t * canmsg;
+
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        LPC_CAN_TypeDef * can = USBTIN_channels[channel].regs;
+
+        if (can->GSR & CAN_GSR_DOS) {
+            can->CMR = CAN_CMR_CDO;
+            USBTIN_engine.canOverrun(channel);
+        }
+
+        // frames are read straight into the receive buffer
+        while (readFrame(can, canmsg = USBTIN_engine.canReceiveSlot(channel))) {
+            canmsg->timestamp = timestamp;
+            USBTIN_engine.canReceive(channel, canmsg);
+        }
+    }
+}
+
+/**
+ * CAN transmit interrupt handler, a transmit buffer became free
+ */
+void UT_canTxIsr(void) {
+    USBTIN_engine.txqueue.isr();
+}
+
+/**
+ * Serial receive callback, called from the UART or USB interrupt
+ */
+void UT_serialRxIsr(void) {
+    USBTIN_engine.serialReceived();
+    USBTIN_clock.signal(UT_SIGNAL_SERIALRX);
+}
+
+/**
+ * Engine tick, called from the us ticker interrupt every CYCLIC_TICK_US
+ */
+void UT_tickIsr(void) {
+    USBTIN_engine.tick();
+}
+
+/**
+ * One-shot timer expiry, called from the us ticker interrupt
+ */
+void UT_timerIsr(void) {
+    USBTIN_engine.timer();
+}
+
+/**
+ * Port: read the core cycle counter, enabled in UT_thread()
+ *
+ * @return CPU cycles
+ */
+uint32_t port_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+UT_MbedClock::UT_MbedClock() : thread(NULL) {
+}
+
+/**
+ * Start the one-shot timer. It runs on the us ticker like the engine
+ * tick, so it has the priority of the CAN interrupt.
+ *
+ * @param delay_us Time until the engine's timer() is called
+ */
+void UT_MbedClock::timerStart(uint32_t delay_us) {
+    timeout.attach_us(&UT_timerIsr, delay_us);
+}
+
+/**
+ * Set bit rate of given channel
+ *
+ * @param channel Channel index
+ * @param hz Bit rate
+ * @return 1 on success
+ */
+unsigned char UT_LpcCan::frequency(unsigned char channel, unsigned long hz) {
+    return USBTIN_channels[channel].port->frequency(hz) != 0;
+}
+
+/**
+ * Go on bus with given channel. The controller is set up for transmit
+ * priority mode, see sendFromIsr().
+ *
+ * @param channel Channel index
+ * @param mode PORT_CAN_NORMAL or PORT_CAN_LISTEN
+ */
+void UT_LpcCan::open(unsigned char channel, unsigned char mode) {
+    channel_t * chan = &USBTIN_channels[channel];
+
+    chan->port->monitor(mode == PORT_CAN_LISTEN);
+    chan->port->reset();
+
+    // TPM may only be changed in reset mode
+    unsigned long mod = chan->regs->MOD;
+    chan->regs->MOD = mod | CAN_MOD_RM;
+    chan->regs->MOD = mod | CAN_MOD_RM | CAN_MOD_TPM;
+    chan->regs->MOD = (mod | CAN_MOD_TPM) & ~CAN_MOD_RM;
+}
+
+/**
+ * Go off bus with given channel, pending transmissions are aborted
+ *
+ * @param channel Channel index
+ */
+void UT_LpcCan::close(unsigned char channel) {
+    USBTIN_channels[channel].port->reset();
+}
 
-Timer UT_t;
 /**
  * Main thread. Entry point for USBtin application.
  * Handles initialization and the the main processing loop.
@@ -48,74 +215,49 @@ Timer UT_t;
  * }
  */
 void UT_thread(void const *args) {
-    deviceState = STATE_CONFIG;
-    UT_t.start();
+    unsigned char channel;
+    unsigned char ticking = 0;
 
-    // buffer for incoming characters
-    char line[LINE_MAXLEN];
-    unsigned char linepos = 0;
+    USBTIN_serialPort->setBaud(USBTIN_SERIAL_BAUD);
 
-    // buffer for incoming can messages
-    canmsg_t canmsg_buffer[CANMSG_BUFFERSIZE];
-    unsigned char canmsg_buffer_filled = 0;
-    unsigned char canmsg_buffer_canpos = 0;
-    unsigned char canmsg_buffer_usbpos = 0;
-    unsigned char rxstep = 0;
+#if USBTIN_PERF
+    // start the DWT cycle counter for the instrumentation
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 
-    unsigned short led_lastclock = UT_t.read_ms();
-    unsigned char led_ticker = 0;
+    // the loop sleeps until an interrupt signals new work
+    USBTIN_clock.thread = Thread::gettid();
+    USBTIN_serialPort->attachRx(&UT_serialRxIsr);
 
-    CANMessage cmsg;
-    USBTIN_serialPort->baud(115200);
+    // can messages are received by interrupt and queued to the receive
+    // buffers, transmit queues are drained from the transmit complete interrupt
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        USBTIN_channels[channel].port->attach(&UT_canRxIsr, CAN::RxIrq);
+        USBTIN_channels[channel].port->attach(&UT_canTxIsr, CAN::TxIrq);
+    }
+
+    // cyclic, ISO-TP and replayed frames are queued from the us ticker interrupt,
+    // which has the priority of the CAN interrupt (see PORT_CAN_LOCK)
+    NVIC_SetPriority(TIMER3_IRQn, NVIC_GetPriority(CAN_IRQn));
 
     // main loop
     while (1) {
-        // handles interrupt requests of MCP2515 controller: receive message and store it to buffer
-        if (deviceState != STATE_CONFIG) {
-            if (USBTIN_CANport->read(cmsg)) {
-                canmsg_buffer[canmsg_buffer_canpos] = fromCANMessage(&cmsg);
-                canmsg_buffer_canpos = (canmsg_buffer_canpos + 1) % CANMSG_BUFFERSIZE;
-                canmsg_buffer_filled++;
-            }
+        USBTIN_engine.process();
 
+        // the engine tick only runs while cyclic frames or ISO-TP transfers
+        // need it, so an idle device is not woken every CYCLIC_TICK_US
+        if (USBTIN_engine.tickActive() != ticking) {
+            ticking = !ticking;
+            if (ticking)
+                UT_ticker.attach_us(&UT_tickIsr, CYCLIC_TICK_US);
+            else
+                UT_ticker.detach();
         }
 
-        // process can messages in receive buffer
-        while (canmsg_buffer_filled > 0) {
-            USBTIN_serialPort->putc(
-                    canmsg2ascii_getNextChar(
-                        &canmsg_buffer[canmsg_buffer_usbpos], &rxstep));
-            if (rxstep == RX_STEP_FINISHED) {
-                // finished this frame
-                rxstep = 0;
-                canmsg_buffer_usbpos = (canmsg_buffer_usbpos + 1)
-                    % CANMSG_BUFFERSIZE;
-                canmsg_buffer_filled--;
-            }
-        }
-
-        // receive characters from virtual serial port and collect the data until end of line is indicated
-        while (USBTIN_serialPort->readable() && (rxstep == 0)) {
-            unsigned char ch = USBTIN_serialPort->getc();
-
-            if (ch == CR) {
-                line[linepos] = 0;
-                parseLine(line);
-                linepos = 0;
-            } else if (ch != LR) {
-                line[linepos] = ch;
-                if (linepos < LINE_MAXLEN - 1)
-                    linepos++;
-            }
-        }
-
-        // led signaling
-        if ((unsigned short) (UT_t.read_ms() - led_lastclock) > 500) {
-            led_lastclock = UT_t.read_ms();
-            led_ticker++;
-        }
-
-        Thread::wait(1);
-
+        // sleep until the next event; signals raised while working
+        // above stay set, so no wake up is lost
+        Thread::signal_wait(0, UT_IDLE_TIMEOUT);
     }
 }
@@ -50,27 +50,28 @@
 #define _USBTIN_
 
 #include "mbed.h"
+#include "rtos.h"
 
-#include "UT_frontend.h"
+#include "us_ticker_api.h"
 
-#define VERSION_HARDWARE_MAJOR 1
-#define VERSION_HARDWARE_MINOR 0
-#define VERSION_FIRMWARE_MAJOR 1
-#define VERSION_FIRMWARE_MINOR 7
-
-#define CANMSG_BUFFERSIZE 8
-
-#define STATE_CONFIG 0
-#define STATE_OPEN 1
-#define STATE_LISTEN 2
+#include "UT_engine.h"
 
 // Port configuration //
+// USBTIN_CAN and USBTIN_CHANNELS are defined in UT_config.h
 #if (USBTIN_CAN == 0)
 #define USBTIN_CAN_RX		(p9)
 #define USBTIN_CAN_TX		(p10)
+#define USBTIN_CAN_REGS		(LPC_CAN1)
+#define USBTIN_CH1_RX		(p30)
+#define USBTIN_CH1_TX		(p29)
+#define USBTIN_CH1_REGS		(LPC_CAN2)
 #elif (USBTIN_CAN == 1)
 #define USBTIN_CAN_RX		(p30)
 #define USBTIN_CAN_TX		(p29)
+#define USBTIN_CAN_REGS		(LPC_CAN2)
+#define USBTIN_CH1_RX		(p9)
+#define USBTIN_CH1_TX		(p10)
+#define USBTIN_CH1_REGS		(LPC_CAN1)
 #endif
 
 #ifndef USBTIN_SERIAL_RX
@@ -81,11 +82,86 @@
 #define USBTIN_SERIAL_TX        (USBTX)
 #endif
 
+// baud rate of the UART at start up, see command 'U'
+#ifndef USBTIN_SERIAL_BAUD
+#define USBTIN_SERIAL_BAUD      (115200)
+#endif
+
+// host link: the UART at USBTIN_SERIAL_TX/RX (through the mbed
+// interface chip by default) or the LPC1768's own USB device
+#define TRANSPORT_UART 0
+#define TRANSPORT_USBCDC 1
+
+#ifndef USBTIN_TRANSPORT
+#define USBTIN_TRANSPORT TRANSPORT_UART
+#endif
+
+// both transports have the same interface
+#if (USBTIN_TRANSPORT == TRANSPORT_USBCDC)
+#include "UT_usbserial.h"
+typedef UT_USBSerial UT_Transport;
+#else
+#include "UT_serial.h"
+typedef UT_Serial UT_Transport;
+#endif
 
-extern CAN *USBTIN_CANport;
-extern Serial *USBTIN_serialPort;
 
-extern unsigned char deviceState;
+// CAN channel description
+typedef struct
+{
+    CAN * port;                 // mbed driver
+    LPC_CAN_TypeDef * regs;     // controller registers
+    unsigned char controller;   // controller number: 0 = CAN1, 1 = CAN2
+    unsigned char txprio;       // next transmit priority, see UT_lpc17xx.cpp
+} channel_t;
+
+extern channel_t USBTIN_channels[USBTIN_CHANNELS];
+
+/**
+ * CAN port on the LPC17xx controllers of USBTIN_channels, see UT_port.h.
+ * Transmission and the acceptance filter bypass the mbed driver
+ * (UT_lpc17xx.cpp).
+ */
+class UT_LpcCan {
+public:
+    unsigned char frequency(unsigned char channel, unsigned long hz);
+    void open(unsigned char channel, unsigned char mode);
+    void close(unsigned char channel);
+    unsigned char sendFromIsr(unsigned char channel, canmsg_t * canmsg);
+    unsigned char setFilter(const idrange_t * std, unsigned short std_count,
+            const idrange_t * ext, unsigned short ext_count);
+};
+
+/**
+ * Clock port on the mbed us ticker. Signals go to the main thread once
+ * UT_thread() has set it.
+ */
+class UT_MbedClock {
+public:
+    UT_MbedClock();
+
+    uint32_t micros(void) {
+        return us_ticker_read();
+    }
+
+    void timerStart(uint32_t delay_us);
+
+    void signal(int32_t signals) {
+        if (thread != NULL)
+            osSignalSet(thread, signals);
+    }
+
+    osThreadId thread;
+
+private:
+    Timeout timeout;
+};
+
+typedef UT_Engine<UT_LpcCan, UT_Transport, UT_MbedClock, UT_DefaultConfig> UT_LpcEngine;
+
+extern UT_Transport *USBTIN_serialPort;
+
+extern UT_LpcEngine USBTIN_engine;
 
 void UT_thread(void const *args);
 
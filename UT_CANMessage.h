@@ -1,13 +1,23 @@
-// can message data structure
+#ifndef _CANMESSAGE_
+#define _CANMESSAGE_
+
+#include <stdint.h>
+
+// bits of the timestamp kept in a can message, see UT_Timestamp::expand()
+#define CANMSG_TIMESTAMP_BITS 28
+#define CANMSG_TIMESTAMP_MASK ((1UL << CANMSG_TIMESTAMP_BITS) - 1)
+
+// can message data structure, packed into 16 bytes:
+// id and flags word, timestamp and dlc word, payload
 typedef struct
 {
-    unsigned long id; 			// identifier (11 or 29 bit)
-    struct {
-       unsigned char rtr : 1;		// remote transmit request
-       unsigned char extended : 1;	// extended identifier
-    } flags;
-
-    unsigned char dlc;                  // data length code
-    unsigned char data[8];		// payload data
-    unsigned short timestamp;           // timestamp
+    uint32_t id : 29;                   // identifier (11 or 29 bit)
+    uint32_t rtr : 1;                   // remote transmit request
+    uint32_t extended : 1;              // extended identifier
+    uint32_t : 1;
+    uint32_t timestamp : CANMSG_TIMESTAMP_BITS; // timestamp (format selected by 'Z'), low bits
+    uint32_t dlc : 4;                   // data length code
+    unsigned char data[8];              // payload data
 } canmsg_t;
+
+#endif
@@ -0,0 +1,317 @@
+/********************************************************************
+ File: UT_binary.cpp
+
+ Description:
+ This file contains the binary framing mode functions.
+ Received frames are collected into one packet per main loop pass,
+ so framing and crc are paid once for a batch of frames.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_binary.h"
+
+#include "UT_core.h"
+
+static const unsigned short crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/**
+ * Calculate CRC-16/CCITT (polynomial 0x1021, init 0xFFFF)
+ *
+ * @param data Data to check
+ * @param len Count of bytes
+ * @return Checksum
+ */
+static unsigned short crc16(const unsigned char * data, unsigned char len) {
+    unsigned short crc = 0xFFFF;
+    while (len--) {
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
+
+/**
+ * COBS encode given data and append the 0x00 delimiter
+ *
+ * @param src Data to encode
+ * @param len Count of bytes
+ * @param dst Output buffer, at least len + len / 254 + 2 bytes
+ * @return Count of bytes written
+ */
+static unsigned char cobs_encode(const unsigned char * src, unsigned char len, unsigned char * dst) {
+    unsigned char * code = dst;
+    unsigned char * p = dst + 1;
+    unsigned char n = 1;
+
+    while (len--) {
+        if (*src == 0) {
+            *code = n;
+            code = p++;
+            n = 1;
+        } else {
+            *p++ = *src;
+            if (++n == 0xFF) {
+                *code = n;
+                code = p++;
+                n = 1;
+            }
+        }
+        src++;
+    }
+    *code = n;
+    *p++ = 0;
+
+    return p - dst;
+}
+
+/**
+ * COBS decode given data in place. The delimiter must not be included.
+ *
+ * @param buf Data to decode
+ * @param len Count of encoded bytes
+ * @return Count of decoded bytes, 0 on error
+ */
+static unsigned char cobs_decode(unsigned char * buf, unsigned char len) {
+    unsigned char * src = buf;
+    unsigned char * dst = buf;
+    unsigned char * end = buf + len;
+
+    while (src < end) {
+        unsigned char code = *src++;
+        if ((code == 0) || (code - 1 > end - src))
+            return 0;
+
+        unsigned char n = code;
+        while (--n)
+            *dst++ = *src++;
+
+        // a full block (0xFF) is not followed by an implicit zero
+        if ((code != 0xFF) && (src < end))
+            *dst++ = 0;
+    }
+    return dst - buf;
+}
+
+UT_Binary::UT_Binary(UT_Device & dev) : dev(dev) {
+    mode = 0;
+    rxpacket_len = 0;
+    inpacket_len = 0;
+    inpacket_overflow = 0;
+}
+
+/**
+ * Append crc to given packet and queue it COBS encoded for sending
+ *
+ * @param packet Packet buffer with 2 spare bytes at the end
+ * @param len Count of bytes without crc
+ */
+void UT_Binary::sendPacket(unsigned char * packet, unsigned char len) {
+    unsigned short crc = crc16(packet, len);
+    packet[len++] = crc & 0xFF;
+    packet[len++] = crc >> 8;
+
+    unsigned char * buf = (unsigned char *) dev.txbuffer.reserve(BIN_ENCODED_MAXLEN);
+    dev.txbuffer.commit(cobs_encode(packet, len, buf));
+}
+
+/**
+ * Send status packet
+ *
+ * @param channel Channel to report the free transmit queue slots of
+ * @param accepted Count of accepted frames
+ * @param error 0 on success, error code otherwise
+ */
+void UT_Binary::sendStatus(unsigned char channel, unsigned char accepted, unsigned char error) {
+    unsigned short space = dev.txqueue.free(channel);
+    unsigned char packet[7];
+    packet[0] = BIN_TYPE_STATUS;
+    packet[1] = 3;
+    packet[2] = accepted;
+    packet[3] = error;
+    packet[4] = (space > 0xFF) ? 0xFF : space;
+    sendPacket(packet, 5);
+}
+
+/**
+ * Append given can message to the pending receive packet.
+ * The packet is sent out if it can't take another record.
+ *
+ * @param channel Channel the message was received on
+ * @param canmsg Pointer to can message
+ * @param stamping Timestamp format, TIMESTAMP_*
+ * @param timestamp Timestamp restored by UT_Timestamp::expand()
+ */
+void UT_Binary::putFrame(unsigned char channel, canmsg_t * canmsg,
+        unsigned char stamping, unsigned long timestamp) {
+    if (rxpacket_len + BIN_RECORD_MAXLEN > 2 + BIN_PAYLOAD_MAXLEN)
+        flush();
+    if (rxpacket_len == 0)
+        rxpacket_len = 2;
+
+    unsigned char * p = &rxpacket[rxpacket_len];
+    unsigned char length = canmsg->dlc;
+    if (length > 8)
+        length = 8;
+
+    *p++ = (canmsg->extended ? BIN_HDR_EXT : 0)
+        | (canmsg->rtr ? BIN_HDR_RTR : 0)
+        | (channel ? BIN_HDR_CHANNEL : 0)
+        | (canmsg->dlc & BIN_HDR_DLC);
+
+    *p++ = canmsg->id & 0xFF;
+    *p++ = (canmsg->id >> 8) & 0xFF;
+    if (canmsg->extended) {
+        *p++ = (canmsg->id >> 16) & 0xFF;
+        *p++ = (canmsg->id >> 24) & 0xFF;
+    }
+
+    if (!canmsg->rtr) {
+        memcpy(p, canmsg->data, length);
+        p += length;
+    }
+
+    if (stamping != TIMESTAMP_OFF) {
+        *p++ = timestamp & 0xFF;
+        *p++ = (timestamp >> 8) & 0xFF;
+        if (stamping == TIMESTAMP_US) {
+            *p++ = (timestamp >> 16) & 0xFF;
+            *p++ = (timestamp >> 24) & 0xFF;
+        }
+    }
+
+    rxpacket_len = p - rxpacket;
+}
+
+/**
+ * Send out the pending receive packet
+ */
+void UT_Binary::flush(void) {
+    if (rxpacket_len == 0)
+        return;
+    rxpacket[0] = BIN_TYPE_RX;
+    rxpacket[1] = rxpacket_len - 2;
+    sendPacket(rxpacket, rxpacket_len);
+    rxpacket_len = 0;
+}
+
+/**
+ * Transmit all frame records of given payload
+ *
+ * @param p Payload
+ * @param len Payload length
+ */
+void UT_Binary::transmitRecords(const unsigned char * p, unsigned char len) {
+    const unsigned char * end = p + len;
+    unsigned char accepted = 0;
+    unsigned char channel = 0;
+
+    while (p < end) {
+        canmsg_t canmsg;
+        unsigned char hdr = *p++;
+        unsigned char idlen = (hdr & BIN_HDR_EXT) ? 4 : 2;
+
+        channel = (hdr & BIN_HDR_CHANNEL) ? 1 : 0;
+        if (channel >= USBTIN_CHANNELS) {
+            sendStatus(0, accepted, BIN_ERROR_FORMAT);
+            return;
+        }
+
+        canmsg.extended = (hdr & BIN_HDR_EXT) != 0;
+        canmsg.rtr = (hdr & BIN_HDR_RTR) != 0;
+        canmsg.dlc = hdr & BIN_HDR_DLC;
+
+        unsigned char length = canmsg.dlc;
+        if (length > 8)
+            length = 8;
+        if (canmsg.rtr)
+            length = 0;
+
+        if (end - p < idlen + length) {
+            sendStatus(channel, accepted, BIN_ERROR_FORMAT);
+            return;
+        }
+
+        canmsg.id = p[0] | ((unsigned long) p[1] << 8);
+        if (idlen == 4)
+            canmsg.id |= ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+        p += idlen;
+
+        memcpy(canmsg.data, p, length);
+        p += length;
+
+        if (dev.state[channel] != STATE_OPEN) {
+            sendStatus(channel, accepted, BIN_ERROR_TRANSMIT);
+            return;
+        }
+        if (!dev.txqueue.put(channel, &canmsg)) {
+            sendStatus(channel, accepted, BIN_ERROR_QUEUEFULL);
+            return;
+        }
+        accepted++;
+    }
+
+    sendStatus(channel, accepted, BIN_ERROR_NONE);
+}
+
+/**
+ * Check and dispatch the collected input packet
+ */
+void UT_Binary::processPacket(void) {
+    unsigned char len = cobs_decode(inpacket, inpacket_len);
+
+    if ((len < 4) || (inpacket[1] != len - 4)) {
+        sendStatus(0, 0, BIN_ERROR_FORMAT);
+        return;
+    }
+
+    len -= 2;
+    if (crc16(inpacket, len) != (inpacket[len] | (inpacket[len + 1] << 8))) {
+        sendStatus(0, 0, BIN_ERROR_CRC);
+        return;
+    }
+
+    switch (inpacket[0]) {
+        case BIN_TYPE_TX:
+            transmitRecords(&inpacket[2], inpacket[1]);
+            break;
+        case BIN_TYPE_ASCII:
+            sendStatus(0, 0, BIN_ERROR_NONE);
+            mode = 0;
+            break;
+        default:
+            sendStatus(0, 0, BIN_ERROR_FORMAT);
+            break;
+    }
+}
+
+/**
+ * Feed one character received in binary mode
+ *
+ * @param ch Received character
+ */
+void UT_Binary::receive(unsigned char ch) {
+    if (ch != 0) {
+        if (inpacket_len < sizeof(inpacket))
+            inpacket[inpacket_len++] = ch;
+        else
+            inpacket_overflow = 1;
+        return;
+    }
+
+    if (inpacket_overflow)
+        sendStatus(0, 0, BIN_ERROR_FORMAT);
+    else if (inpacket_len > 0) {
+        PERF_BEGIN(start);
+        processPacket();
+        PERF_END(dev.perf, PERF_PARSE, start);
+    }
+
+    inpacket_len = 0;
+    inpacket_overflow = 0;
+}
@@ -0,0 +1,78 @@
+/********************************************************************
+ File: UT_binary.h
+
+ Description:
+ This file contains the binary framing mode definitions.
+
+ Packet layout before COBS encoding (multi byte values little endian):
+   type (1) | payload length (1) | payload | crc16 (2)
+ Each packet is COBS encoded and terminated by a 0x00 byte. The crc
+ (CCITT, init 0xFFFF) covers type, length and payload.
+
+ Frame packets (BIN_TYPE_RX, BIN_TYPE_TX) carry one or more records:
+   header (1) | id (2 or 4) | data (0..8) | timestamp (0, 2 or 4)
+ header bit 7: extended id, bit 6: rtr, bit 4: channel 1, bits 3..0: dlc.
+ The timestamp is only present in received frames with time stamping
+ enabled: 2 bytes in millisecond mode, 4 bytes in microsecond mode.
+
+ ********************************************************************/
+#ifndef _BINARY_
+#define _BINARY_
+
+#include "UT_CANMessage.h"
+
+#define BIN_TYPE_RX 0x01        // device -> host: received frames
+#define BIN_TYPE_TX 0x02        // host -> device: frames to transmit
+#define BIN_TYPE_STATUS 0x03    // device -> host: accepted frames, error code, free transmit queue slots of the last channel
+#define BIN_TYPE_ASCII 0x04     // host -> device: return to ascii mode
+
+#define BIN_ERROR_NONE 0
+#define BIN_ERROR_CRC 1         // crc mismatch, packet dropped
+#define BIN_ERROR_FORMAT 2      // malformed or unknown packet
+#define BIN_ERROR_TRANSMIT 3    // channel not open
+#define BIN_ERROR_QUEUEFULL 4   // transmit queue full, remaining frames dropped
+
+#define BIN_HDR_EXT 0x80
+#define BIN_HDR_RTR 0x40
+#define BIN_HDR_CHANNEL 0x10
+#define BIN_HDR_DLC 0x0F
+
+// largest record: header + extended id + data + timestamp
+#define BIN_RECORD_MAXLEN (1 + 4 + 8 + 4)
+#define BIN_PAYLOAD_MAXLEN 120
+// type + length + payload + crc, plus COBS overhead and delimiter
+#define BIN_PACKET_MAXLEN (2 + BIN_PAYLOAD_MAXLEN + 2)
+#define BIN_ENCODED_MAXLEN (BIN_PACKET_MAXLEN + BIN_PACKET_MAXLEN / 254 + 2)
+
+class UT_Device;
+
+class UT_Binary {
+public:
+    UT_Binary(UT_Device & dev);
+
+    void putFrame(unsigned char channel, canmsg_t * canmsg,
+            unsigned char stamping, unsigned long timestamp);
+    void flush(void);
+    void receive(unsigned char ch);
+
+    unsigned char mode;     // 1 while binary framing is active
+
+private:
+    void sendPacket(unsigned char * packet, unsigned char len);
+    void sendStatus(unsigned char channel, unsigned char accepted, unsigned char error);
+    void transmitRecords(const unsigned char * p, unsigned char len);
+    void processPacket(void);
+
+    UT_Device & dev;
+
+    // received frames waiting to be sent as one packet
+    unsigned char rxpacket[BIN_PACKET_MAXLEN];
+    unsigned char rxpacket_len;
+
+    // incoming encoded packet
+    unsigned char inpacket[BIN_ENCODED_MAXLEN];
+    unsigned char inpacket_len;
+    unsigned char inpacket_overflow;
+};
+
+#endif
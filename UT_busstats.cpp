@@ -0,0 +1,166 @@
+/********************************************************************
+ File: UT_busstats.cpp
+
+ Description:
+ This file contains the bus statistics functions.
+ Counters are only written by the CAN interrupt (receive path and
+ transmit queue), window bases only by the thread, so a window can
+ be started without masking the interrupt. Snapshots read 32-bit
+ fields, which the interrupt updates atomically.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_busstats.h"
+
+#include "UT_core.h"
+
+#if !IDHASH_SIZE_VALID(BUSSTATS_TABLE_SIZE)
+#error "BUSSTATS_TABLE_SIZE must be a power of two not greater than 32768"
+#endif
+
+UT_BusStats::UT_BusStats(UT_Device & dev) : dev(dev) {
+    enabled = 0;
+    memset(bitrate, 0, sizeof(bitrate));
+    memset(window_us, 0, sizeof(window_us));
+    memset(window_bits, 0, sizeof(window_bits));
+}
+
+/**
+ * Start a new window of given channel
+ *
+ * @param channel Channel index
+ */
+void UT_BusStats::restart(unsigned char channel) {
+    unsigned short i;
+
+    window_us[channel] = dev.micros();
+    window_bits[channel] = channels[channel].bits;
+    for (i = 0; i < BUSSTATS_TABLE_SIZE; i++) {
+        volatile busstats_entry_t * entry = &table[i];
+        if (((entry->key & IDHASH_KEY_CHANNEL) != 0) == (channel != 0))
+            entry->base = entry->count;
+    }
+}
+
+/**
+ * Switch statistics on or off. Switching on starts from zero.
+ *
+ * @param enable 1 to collect statistics
+ */
+void UT_BusStats::enable(unsigned char enable) {
+    unsigned char channel;
+
+    PORT_CAN_LOCK();
+    enabled = 0;
+    PORT_CAN_UNLOCK();
+    if (!enable)
+        return;
+
+    memset((void *) table, 0, sizeof(table));
+    memset((void *) channels, 0, sizeof(channels));
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++)
+        restart(channel);
+    PORT_BARRIER();
+    enabled = 1;
+}
+
+/**
+ * Remember bit rate of given channel for the bus load
+ *
+ * @param channel Channel index
+ * @param hz Bit rate
+ */
+void UT_BusStats::setBitrate(unsigned char channel, unsigned long hz) {
+    bitrate[channel] = hz;
+}
+
+/**
+ * Count received frame (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @param now Reception time in us
+ */
+void UT_BusStats::receive(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    volatile busstats_channel_t * stats = &channels[channel];
+    uint32_t key = idhash_key(channel, canmsg->id, canmsg->extended);
+    unsigned short slot = idhash_find(table, sizeof(busstats_entry_t), BUSSTATS_TABLE_SIZE, key);
+
+    stats->frames++;
+    stats->bits += busstats_frameBits(canmsg);
+    stats->dlc[(canmsg->dlc > 8) ? 8 : canmsg->dlc]++;
+
+    if (slot == BUSSTATS_TABLE_SIZE) {
+        stats->untracked++;
+        return;
+    }
+    volatile busstats_entry_t * entry = &table[slot];
+    entry->key = key;
+    entry->count++;
+    entry->last_us = now;
+    entry->dlc = canmsg->dlc;
+}
+
+/**
+ * Count transmitted frame for the bus load (CAN interrupt context)
+ *
+ * @param channel Channel the frame is sent on
+ * @param canmsg Frame
+ */
+void UT_BusStats::transmit(unsigned char channel, canmsg_t * canmsg) {
+    channels[channel].bits += busstats_frameBits(canmsg);
+}
+
+/**
+ * Read the current window of given channel
+ *
+ * @param channel Channel index
+ * @param elapsed_ms Output window length in ms
+ * @param load_permille Output bus load in 1/1000
+ */
+void UT_BusStats::window(unsigned char channel, uint32_t * elapsed_ms, unsigned short * load_permille) {
+    uint32_t elapsed_us = dev.micros() - window_us[channel];
+    uint32_t bits = channels[channel].bits - window_bits[channel];
+    unsigned long long capacity = (unsigned long long) bitrate[channel] * elapsed_us;
+
+    *elapsed_ms = elapsed_us / 1000;
+    *load_permille = capacity ? (unsigned short) (bits * 1000000000ULL / capacity) : 0;
+}
+
+/**
+ * Get the ids of given channel with the most frames in the current
+ * window, ordered by count
+ *
+ * @param channel Channel index
+ * @param index Output table indices
+ * @param n Count of ids wanted
+ * @return Count of ids found
+ */
+unsigned short UT_BusStats::top(unsigned char channel, unsigned short * index, unsigned short n) {
+    unsigned short found = 0;
+    unsigned short i, j;
+
+    for (i = 0; i < BUSSTATS_TABLE_SIZE; i++) {
+        volatile busstats_entry_t * entry = &table[i];
+        if ((entry->key == 0) || (((entry->key & IDHASH_KEY_CHANNEL) != 0) != (channel != 0)))
+            continue;
+
+        // insertion into the sorted list, dropping the last one if full
+        uint32_t count = entry->count - entry->base;
+        for (j = found; j > 0; j--) {
+            volatile busstats_entry_t * other = &table[index[j - 1]];
+            if (other->count - other->base >= count)
+                break;
+            if (j < n)
+                index[j] = index[j - 1];
+        }
+        if (j < n) {
+            index[j] = i;
+            if (found < n)
+                found++;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,93 @@
+/********************************************************************
+ File: UT_busstats.h
+
+ Description:
+ This file contains the bus statistics definitions. While enabled,
+ the receive interrupt counts frames per id in a fixed size table,
+ remembers when and with which DLC each id was last seen, keeps a
+ DLC histogram per channel and sums up the bits of received and
+ transmitted frames for the bus load. The host reads snapshots
+ instead of the raw traffic.
+
+ Rates and bus load refer to a window started by the last summary
+ read. Frame lengths are nominal, without stuff bits.
+
+ ********************************************************************/
+#ifndef _BUSSTATS_
+#define _BUSSTATS_
+
+#include <stdint.h>
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+#include "UT_idhash.h"
+
+// ids tracked, see IDHASH_SIZE_VALID
+#ifndef BUSSTATS_TABLE_SIZE
+#define BUSSTATS_TABLE_SIZE 256
+#endif
+
+// ids per top list
+#ifndef BUSSTATS_TOPMAX
+#define BUSSTATS_TOPMAX 32
+#endif
+
+typedef struct
+{
+    uint32_t key;               // id, format and channel, 0 if unused
+    uint32_t count;             // frames since enabled
+    uint32_t base;              // count at the start of the window
+    uint32_t last_us;           // time the id was last received
+    unsigned char dlc;          // last DLC
+} busstats_entry_t;
+
+typedef struct
+{
+    uint32_t frames;            // frames received since enabled
+    uint32_t untracked;         // frames of ids not fitting the table
+    uint32_t bits;              // nominal bits received and transmitted
+    uint32_t dlc[9];            // received frames per DLC, 8 includes larger
+} busstats_channel_t;
+
+class UT_Device;
+
+class UT_BusStats {
+public:
+    UT_BusStats(UT_Device & dev);
+
+    void enable(unsigned char enable);
+    void setBitrate(unsigned char channel, unsigned long hz);
+    void receive(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    void transmit(unsigned char channel, canmsg_t * canmsg);
+
+    void window(unsigned char channel, uint32_t * elapsed_ms, unsigned short * load_permille);
+    void restart(unsigned char channel);
+    unsigned short top(unsigned char channel, unsigned short * index, unsigned short n);
+
+    volatile unsigned char enabled;
+    volatile busstats_entry_t table[BUSSTATS_TABLE_SIZE];
+    volatile busstats_channel_t channels[USBTIN_CHANNELS];
+
+private:
+    UT_Device & dev;
+
+    // thread side window state
+    unsigned long bitrate[USBTIN_CHANNELS];
+    uint32_t window_us[USBTIN_CHANNELS];
+    uint32_t window_bits[USBTIN_CHANNELS];
+};
+
+/**
+ * Get nominal length of given frame including interframe space
+ *
+ * @param canmsg Frame
+ * @return Bits without stuff bits
+ */
+static inline unsigned short busstats_frameBits(canmsg_t * canmsg) {
+    unsigned short bits = canmsg->extended ? 67 : 47;
+    if (!canmsg->rtr)
+        bits += 8 * ((canmsg->dlc > 8) ? 8 : canmsg->dlc);
+    return bits;
+}
+
+#endif
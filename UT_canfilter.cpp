@@ -0,0 +1,139 @@
+/********************************************************************
+ File: UT_canfilter.cpp
+
+ Description:
+ This file contains the hardware acceptance filter functions.
+
+ Like the USBtin firmware, code and mask describe two filters on
+ standard identifiers: ACR0/ACR1 with AMR0/AMR1 and ACR2/ACR3 with
+ AMR2/AMR3, each holding the id in the upper 11 bits. A set mask bit
+ means "don't care". Extended frames are not filtered by code/mask.
+
+ Once an explicit id is loaded ('a'/'A'), only the explicit lists
+ are used and all other frames are rejected.
+
+ ********************************************************************/
+
+#include "UT_canfilter.h"
+
+#include "UT_core.h"
+
+#define STD_ID_MASK 0x7FFUL
+#define EXT_ID_MASK 0x1FFFFFFFUL
+
+UT_CanFilter::UT_CanFilter(UT_Device & dev) : dev(dev) {
+    code = 0x00000000;
+    mask = 0xFFFFFFFF;
+    std_count = 0;
+    ext_count = 0;
+    explicitLists = 0;
+}
+
+/**
+ * Add the standard ids matching given code and don't care mask.
+ * Don't care bits below the lowest fixed bit form one range, every
+ * combination of the higher don't care bits adds another range.
+ *
+ * @param code 11-bit acceptance code
+ * @param mask 11-bit don't care mask
+ * @return 1 on success, 0 if the ranges don't fit
+ */
+unsigned char UT_CanFilter::addCodeMask(unsigned long code, unsigned long mask) {
+    unsigned long low = (mask + 1) & ~mask;     // lowest fixed bit
+    unsigned long span = low - 1;               // contiguous don't care bits below
+    unsigned long high = mask & ~span;
+    unsigned long sub = 0;
+
+    code &= ~mask;
+    do {
+        if (!idrange_add(stdranges, &std_count, CANFILTER_MAXRANGES, code | sub, code | sub | span))
+            return 0;
+        sub = (sub - high) & high;
+    } while (sub != 0);
+
+    return 1;
+}
+
+/**
+ * Set acceptance code (command 'M')
+ *
+ * @param code ACR0..ACR3, ACR0 in the most significant byte
+ */
+void UT_CanFilter::setCode(unsigned long code) {
+    this->code = code;
+}
+
+/**
+ * Set acceptance mask (command 'm')
+ *
+ * @param mask AMR0..AMR3, AMR0 in the most significant byte
+ */
+void UT_CanFilter::setMask(unsigned long mask) {
+    this->mask = mask;
+}
+
+/**
+ * Add standard id range to the explicit list
+ *
+ * @param lo First id
+ * @param hi Last id
+ * @return 1 on success, 0 on invalid range or full list
+ */
+unsigned char UT_CanFilter::addStd(unsigned long lo, unsigned long hi) {
+    if ((lo > hi) || (hi > STD_ID_MASK))
+        return 0;
+    if (!explicitLists)
+        clearLists();
+    explicitLists = 1;
+    return idrange_add(stdranges, &std_count, CANFILTER_MAXRANGES, lo, hi);
+}
+
+/**
+ * Add extended id range to the explicit list
+ *
+ * @param lo First id
+ * @param hi Last id
+ * @return 1 on success, 0 on invalid range or full list
+ */
+unsigned char UT_CanFilter::addExt(unsigned long lo, unsigned long hi) {
+    if ((lo > hi) || (hi > EXT_ID_MASK))
+        return 0;
+    if (!explicitLists)
+        clearLists();
+    explicitLists = 1;
+    return idrange_add(extranges, &ext_count, CANFILTER_MAXRANGES, lo, hi);
+}
+
+/**
+ * Drop explicit id lists and return to code/mask filtering
+ */
+void UT_CanFilter::clearLists(void) {
+    std_count = 0;
+    ext_count = 0;
+    explicitLists = 0;
+}
+
+/**
+ * Translate code/mask or the explicit lists into id ranges and load
+ * them into the port's acceptance filter.
+ * Falls back to accepting everything if code/mask need more ranges
+ * than fit. Called while the channel is closed.
+ */
+void UT_CanFilter::apply(void) {
+    if (!explicitLists) {
+        std_count = 0;
+        ext_count = 0;
+
+        if (((mask >> 21) & STD_ID_MASK) == STD_ID_MASK
+                || ((mask >> 5) & STD_ID_MASK) == STD_ID_MASK
+                || !addCodeMask((code >> 21) & STD_ID_MASK, (mask >> 21) & STD_ID_MASK)
+                || !addCodeMask((code >> 5) & STD_ID_MASK, (mask >> 5) & STD_ID_MASK)) {
+            // accepts everything or too many ranges
+            dev.canSetFilter(NULL, 0, NULL, 0);
+            return;
+        }
+        idrange_add(extranges, &ext_count, CANFILTER_MAXRANGES, 0, EXT_ID_MASK);
+    }
+
+    dev.canSetFilter(stdranges, std_count, extranges, ext_count);
+}
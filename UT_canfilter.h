@@ -0,0 +1,54 @@
+/********************************************************************
+ File: UT_canfilter.h
+
+ Description:
+ This file contains the hardware acceptance filter definitions.
+ The SJA1000 style code/mask of commands 'M'/'m' and explicit id
+ lists are translated to id ranges for the port's acceptance filter
+ (the LPC17xx lookup table on the device), so unwanted frames never
+ raise a receive interrupt.
+
+ ********************************************************************/
+#ifndef _CANFILTER_
+#define _CANFILTER_
+
+#include "UT_idrange.h"
+
+// maximum count of merged id ranges per list
+#ifndef CANFILTER_MAXRANGES
+#define CANFILTER_MAXRANGES 128
+#endif
+
+class UT_Device;
+
+class UT_CanFilter {
+public:
+    UT_CanFilter(UT_Device & dev);
+
+    void setCode(unsigned long code);
+    void setMask(unsigned long mask);
+
+    unsigned char addStd(unsigned long lo, unsigned long hi);
+    unsigned char addExt(unsigned long lo, unsigned long hi);
+    void clearLists(void);
+
+    void apply(void);
+
+private:
+    unsigned char addCodeMask(unsigned long code, unsigned long mask);
+
+    UT_Device & dev;
+
+    // SJA1000 acceptance code/mask, reset state accepts everything
+    unsigned long code;
+    unsigned long mask;
+
+    // sorted, non overlapping id ranges
+    idrange_t stdranges[CANFILTER_MAXRANGES];
+    unsigned short std_count;
+    idrange_t extranges[CANFILTER_MAXRANGES];
+    unsigned short ext_count;
+    unsigned char explicitLists;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/********************************************************************
+ File: UT_change.cpp
+
+ Description:
+ This file contains the change-only forwarding functions.
+ Payloads are kept per id in an UT_idhash table. Once the table is
+ full, frames of new identifiers are always passed.
+ The table is changed from the thread with the CAN interrupt masked.
+ check() and commit() of a frame run in the same receive interrupt,
+ so the entry found by check() is still valid in commit().
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_change.h"
+
+#include "UT_port.h"
+#include "UT_idhash.h"
+
+#if !IDHASH_SIZE_VALID(CHANGE_TABLE_SIZE)
+#error "CHANGE_TABLE_SIZE must be a power of two not greater than 32768"
+#endif
+
+#define CHANGE_FLAG_SEEN 0x01       // dlc and data are valid
+#define CHANGE_FLAG_RTR 0x02
+#define CHANGE_FLAG_KEEPALIVE 0x04  // keepalive set for this id
+
+UT_Change::UT_Change(void) {
+    mode = 0;
+    memset(table, 0, sizeof(table));
+    keepalive = 0;
+    pending = NULL;
+    memset((void *) suppressed, 0, sizeof(suppressed));
+    memset((void *) untracked, 0, sizeof(untracked));
+}
+
+/**
+ * Find entry of given key or the free slot to insert it into
+ *
+ * @param key Table key
+ * @return Entry, NULL if the key is missing and the table is full
+ */
+change_entry_t * UT_Change::lookup(uint32_t key) {
+    unsigned short slot = idhash_find(table, sizeof(change_entry_t), CHANGE_TABLE_SIZE, key);
+    return (slot < CHANGE_TABLE_SIZE) ? &table[slot] : NULL;
+}
+
+/**
+ * Switch change-only forwarding on or off. Switching on starts with
+ * an empty payload cache, so every id is passed once.
+ *
+ * @param mode 1 to forward changed frames only, 0 to forward all
+ */
+void UT_Change::setMode(unsigned char mode) {
+    unsigned short i;
+
+    PORT_CAN_LOCK();
+    for (i = 0; i < CHANGE_TABLE_SIZE; i++)
+        table[i].flags &= ~CHANGE_FLAG_SEEN;
+    pending = NULL;
+    this->mode = mode;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Set keep-alive interval of ids without an own interval
+ *
+ * @param ms Interval in ms, 0 to pass unchanged frames never
+ */
+void UT_Change::setKeepalive(unsigned short ms) {
+    unsigned short i;
+
+    PORT_CAN_LOCK();
+    keepalive = ms;
+    for (i = 0; i < CHANGE_TABLE_SIZE; i++)
+        if (!(table[i].flags & CHANGE_FLAG_KEEPALIVE))
+            table[i].keepalive = ms;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Set keep-alive interval of given id
+ *
+ * @param channel Channel index
+ * @param id Identifier
+ * @param extended 1 for extended identifier
+ * @param ms Interval in ms, 0 to pass unchanged frames never
+ * @return 1 on success, 0 if the table is full
+ */
+unsigned char UT_Change::setIdKeepalive(unsigned char channel, unsigned long id,
+        unsigned char extended, unsigned short ms) {
+    uint32_t key = idhash_key(channel, id, extended);
+    unsigned char ok = 0;
+
+    PORT_CAN_LOCK();
+    change_entry_t * entry = lookup(key);
+    if (entry != NULL) {
+        if (entry->key == 0) {
+            entry->key = key;
+            entry->flags = 0;
+        }
+        entry->keepalive = ms;
+        entry->flags |= CHANGE_FLAG_KEEPALIVE;
+        ok = 1;
+    }
+    PORT_CAN_UNLOCK();
+    return ok;
+}
+
+/**
+ * Forget all ids, payloads and keep-alive intervals, reset statistics
+ */
+void UT_Change::clear(void) {
+    unsigned char channel;
+
+    PORT_CAN_LOCK();
+    memset(table, 0, sizeof(table));
+    keepalive = 0;
+    pending = NULL;
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        suppressed[channel] = 0;
+        untracked[channel] = 0;
+    }
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Compare given frame with the cached one (receive interrupt). The
+ * cache is only updated by commit().
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @param now Reception time in us
+ * @return 1 to pass the frame, 0 if it is unchanged
+ */
+unsigned char UT_Change::check(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    uint32_t key = idhash_key(channel, canmsg->id, canmsg->extended);
+    change_entry_t * entry = lookup(key);
+    unsigned char flags = canmsg->rtr ? CHANGE_FLAG_RTR : 0;
+    unsigned char len = canmsg->rtr ? 0 : (canmsg->dlc > 8 ? 8 : canmsg->dlc);
+
+    pending = entry;
+    if (entry == NULL) {
+        untracked[channel]++;
+        return 1;
+    }
+
+    if ((entry->flags & CHANGE_FLAG_SEEN)
+            && ((entry->flags & CHANGE_FLAG_RTR) == flags)
+            && (entry->dlc == canmsg->dlc)
+            && (memcmp(entry->data, canmsg->data, len) == 0)
+            && ((entry->keepalive == 0) || ((uint32_t) (now - entry->last_us) < entry->keepalive * 1000UL))) {
+        suppressed[channel]++;
+        pending = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Remember given frame passed by the last check() (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Frame passed by check()
+ * @param now Reception time in us
+ */
+void UT_Change::commit(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    change_entry_t * entry = pending;
+    unsigned char flags = canmsg->rtr ? CHANGE_FLAG_RTR : 0;
+    unsigned char len = canmsg->rtr ? 0 : (canmsg->dlc > 8 ? 8 : canmsg->dlc);
+
+    if (entry == NULL)
+        return;
+    pending = NULL;
+
+    if (entry->key == 0) {
+        entry->key = idhash_key(channel, canmsg->id, canmsg->extended);
+        entry->keepalive = keepalive;
+    }
+    entry->flags = (entry->flags & CHANGE_FLAG_KEEPALIVE) | CHANGE_FLAG_SEEN | flags;
+    entry->dlc = canmsg->dlc;
+    memcpy(entry->data, canmsg->data, len);
+    entry->last_us = now;
+}
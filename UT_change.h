@@ -0,0 +1,96 @@
+/********************************************************************
+ File: UT_change.h
+
+ Description:
+ This file contains the change-only forwarding definitions. In
+ change-only mode the receive interrupt remembers the last DLC and
+ payload per identifier in a fixed size open addressing hash table
+ and only passes frames to the host that differ from it. An optional
+ keep-alive interval passes an unchanged frame again once that much
+ time went by since the identifier was last passed.
+
+ A passed frame is only remembered once it was stored in the receive
+ buffer (delivered()), so a change lost to a full buffer is passed
+ again with the next frame of the id.
+
+ ********************************************************************/
+#ifndef _CHANGE_
+#define _CHANGE_
+
+#include <stdint.h>
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+// identifiers tracked, must be a power of two
+#ifndef CHANGE_TABLE_SIZE
+#define CHANGE_TABLE_SIZE 256
+#endif
+
+typedef struct
+{
+    uint32_t key;               // id, format and channel, 0 if unused
+    uint32_t last_us;           // time the id was last passed
+    unsigned short keepalive;   // ms, 0 = never
+    unsigned char flags;        // CHANGE_FLAG_*
+    unsigned char dlc;
+    unsigned char data[8];
+} change_entry_t;
+
+class UT_Change {
+public:
+    UT_Change(void);
+
+    void setMode(unsigned char mode);
+    void setKeepalive(unsigned short ms);
+    unsigned char setIdKeepalive(unsigned char channel, unsigned long id,
+            unsigned char extended, unsigned short ms);
+    void clear(void);
+
+    unsigned char check(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    void commit(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    inline unsigned char accept(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    inline void delivered(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+
+    volatile unsigned char mode;
+    volatile unsigned long suppressed[USBTIN_CHANNELS];
+    volatile unsigned long untracked[USBTIN_CHANNELS];
+
+private:
+    change_entry_t * lookup(uint32_t key);
+
+    change_entry_t table[CHANGE_TABLE_SIZE];
+    unsigned short keepalive;
+
+    // entry of the frame last passed by check(), NULL if none
+    change_entry_t * pending;
+};
+
+/**
+ * Check given frame against the last payload of its id (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @param now Reception time in us
+ * @return 1 to pass the frame, 0 if it is unchanged
+ */
+inline unsigned char UT_Change::accept(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    if (!mode)
+        return 1;
+    return check(channel, canmsg, now);
+}
+
+/**
+ * Remember the frame passed by accept() once it was stored in the
+ * receive buffer (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Stored frame
+ * @param now Reception time in us
+ */
+inline void UT_Change::delivered(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    if (mode)
+        commit(channel, canmsg, now);
+}
+
+#endif
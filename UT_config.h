@@ -0,0 +1,54 @@
+/********************************************************************
+ File: UT_config.h
+
+ Description:
+ This file contains the protocol engine configuration defaults and
+ the constants shared by all engine modules. Everything here may be
+ overridden on the compiler command line.
+
+ ********************************************************************/
+#ifndef _CONFIG_
+#define _CONFIG_
+
+#define VERSION_HARDWARE_MAJOR 1
+#define VERSION_HARDWARE_MINOR 0
+#define VERSION_FIRMWARE_MAJOR 1
+#define VERSION_FIRMWARE_MINOR 7
+
+// receive buffer depth in frames, power of two (see UT_DefaultConfig)
+#ifndef CANMSG_BUFFERSIZE
+#define CANMSG_BUFFERSIZE 256
+#endif
+
+// receive buffer overflow policy
+#define OVERFLOW_DROP_NEWEST 0
+#define OVERFLOW_DROP_OLDEST 1
+
+#ifndef CANMSG_OVERFLOW_POLICY
+#define CANMSG_OVERFLOW_POLICY OVERFLOW_DROP_NEWEST
+#endif
+
+// main thread wake up signals
+#define UT_SIGNAL_CANRX 0x01
+#define UT_SIGNAL_SERIALRX 0x02
+
+// longest main thread sleep without events, in ms
+#ifndef UT_IDLE_TIMEOUT
+#define UT_IDLE_TIMEOUT 500
+#endif
+
+#define STATE_CONFIG 0
+#define STATE_OPEN 1
+#define STATE_LISTEN 2
+
+// USBTIN_CAN selects the controller of channel 0, channel 1 uses the other one
+#ifndef USBTIN_CAN
+#define USBTIN_CAN (0)
+#endif
+
+// count of CAN channels, 1 or 2
+#ifndef USBTIN_CHANNELS
+#define USBTIN_CHANNELS 1
+#endif
+
+#endif
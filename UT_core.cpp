@@ -0,0 +1,198 @@
+/********************************************************************
+ File: UT_core.cpp
+
+ Description:
+ This file contains the protocol engine functions that don't depend
+ on the ports: set up, tick and timer dispatch and the handling of
+ incoming command lines. The receive path and the main loop pass are
+ part of the class template in UT_engine.h.
+
+ ********************************************************************/
+
+#include "UT_core.h"
+
+#include <string.h>
+
+UT_Device::UT_Device(char * txbuf, unsigned short txsize, unsigned short rxsize,
+        unsigned char timestamps, device_bulk0_t & bulk0, device_bulk1_t & bulk1)
+        : rxsize(rxsize), timestamp(timestamps), canfilter(*this), gateway(*this),
+          cyclic(*this), isotp(*this, bulk0.isotp_tx, bulk1.isotp_rx),
+          replay(*this, bulk0.replay), busstats(*this), txqueue(*this), sched(*this),
+          binary(*this), txbuffer(*this, txbuf, txsize) {
+    unsigned char channel;
+
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        state[channel] = STATE_CONFIG;
+        rxstats[channel].dropped_full = 0;
+        rxstats[channel].dropped_overrun = 0;
+        rxstats[channel].highwater = 0;
+        rxstats[channel].overrun = 0;
+    }
+    serialBaud = 0;
+    commands = 0;
+    linepos = 0;
+    lineoverflow = 0;
+    pdumode = 0;
+}
+
+/**
+ * Reset drop counters and high-water mark of the receive buffer
+ *
+ * @param channel Channel index
+ */
+void UT_Device::rxClearStats(unsigned char channel) {
+    volatile rxbuffer_stats_t * stats = &rxstats[channel];
+    PORT_CAN_LOCK();
+    stats->dropped_full = 0;
+    stats->dropped_overrun = 0;
+    stats->highwater = 0;
+    stats->overrun = 0;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Read and reset the receive loss flag. The receive interrupt is
+ * masked, so a loss flagged meanwhile is reported by the next call.
+ *
+ * @param channel Channel index
+ * @return 1 if frames were lost since the last call
+ */
+unsigned char UT_Device::rxTakeOverrun(unsigned char channel) {
+    unsigned char overrun;
+
+    PORT_CAN_LOCK();
+    overrun = rxstats[channel].overrun;
+    rxstats[channel].overrun = 0;
+    PORT_CAN_UNLOCK();
+    return overrun;
+}
+
+/**
+ * Engine tick, called by the port every CYCLIC_TICK_US from an
+ * interrupt of the CAN interrupt's priority
+ */
+void UT_Device::tick(void) {
+    cyclic.tick();
+    isotp.tick();
+}
+
+/**
+ * Check if the engine needs the tick. A port may skip ticks while
+ * it returns 0: the mbed port stops its ticker, the simulator ends
+ * idle runs. Ports check it after each process() pass, the engine
+ * signals the thread when the result turns 1 outside a pass.
+ *
+ * @return 1 if cyclic frames or ISO-TP transfers are pending
+ */
+unsigned char UT_Device::tickActive(void) {
+    return cyclic.active() || isotp.active();
+}
+
+/**
+ * One-shot timer expiry, see the clock's timerStart(). Called by the
+ * port from an interrupt of the CAN interrupt's priority.
+ */
+void UT_Device::timer(void) {
+    replay.timer();
+}
+
+/**
+ * Parse a command line and time it
+ *
+ * @param cmd Zero terminated command line
+ */
+void UT_Device::parseCommand(char * cmd) {
+    PERF_BEGIN(start);
+    parseLine(cmd);
+    PERF_END(perf, PERF_PARSE, start);
+    commands++;
+}
+
+/**
+ * Handle received characters. Command lines that lie complete and in
+ * one piece in the receive ring are parsed in place; a line that is
+ * still arriving is left there until its CR follows. Only lines
+ * wrapping around the end of the ring, ISO-TP PDUs and binary mode
+ * input are taken character by character. Lines longer than
+ * LINE_MAXLEN - 1 and lines with characters lost by the serial port
+ * (PORT_SERIAL_LOST) are discarded and answered with BELL. Handling
+ * stops at the start of a line once the command budget of the pass
+ * is used up.
+ *
+ * @param data Received characters, parsed lines are modified
+ * @param len Count of characters
+ * @param more 1 if further characters follow at the start of the ring
+ * @return Count of characters consumed
+ */
+unsigned short UT_Device::receive(char * data, unsigned short len, unsigned char more) {
+    unsigned short pos = 0;
+
+    while (pos < len) {
+        if (!binary.mode && !pdumode && (linepos == 0) && !lineoverflow) {
+            char * cmd = &data[pos];
+            unsigned short avail = len - pos;
+
+            if (sched.config.cmd_budget && (commands >= sched.config.cmd_budget))
+                return pos;
+
+            if (*cmd == LR) {
+                pos++;
+                continue;
+            }
+            if (*cmd != 'X') {
+                char * end = (char *) memchr(cmd, CR, avail);
+                if ((end != NULL) && (memchr(cmd, LR, end - cmd) == NULL)
+                        && (memchr(cmd, PORT_SERIAL_LOST, end - cmd) == NULL)) {
+                    unsigned short n = end - cmd;
+                    if (n < LINE_MAXLEN) {
+                        *end = 0;
+                        parseCommand(cmd);
+                    } else {
+                        txbuffer.putc(BELL);
+                    }
+                    pos += n + 1;
+                    continue;
+                }
+                // wait for the rest of the line unless it wraps or is already too long
+                if ((end == NULL) && !more && (avail < LINE_MAXLEN))
+                    return pos;
+            }
+        }
+
+        char ch = data[pos++];
+
+        if (binary.mode) {
+            binary.receive(ch);
+        } else if (pdumode) {
+            // PDU data bypasses the line buffer
+            if (ch == CR) {
+                txbuffer.putc(isotp.end() ? CR : BELL);
+                pdumode = 0;
+                linepos = 0;
+            } else if (ch != LR) {
+                isotp.putHex(ch);
+            }
+        } else if (ch == CR) {
+            if (lineoverflow) {
+                txbuffer.putc(BELL);
+            } else {
+                line[linepos] = 0;
+                parseCommand(line);
+            }
+            linepos = 0;
+            lineoverflow = 0;
+        } else if (ch == PORT_SERIAL_LOST) {
+            if (!lineoverflow)
+                sched.stats.input_lost++;
+            lineoverflow = 1;
+        } else if (ch != LR) {
+            if (linepos < LINE_MAXLEN - 1)
+                line[linepos++] = ch;
+            else
+                lineoverflow = 1;
+            if ((linepos == 2) && (line[0] == 'X'))
+                pdumode = isotp.begin(line[1] - '0');
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,122 @@
+/********************************************************************
+ File: UT_core.h
+
+ Description:
+ This file contains the protocol engine definitions. UT_Device holds
+ the complete state of one engine instance: channel states, receive
+ statistics, the feature modules and the command line parser. The
+ ports it runs on, the receive buffer and the constant configuration
+ are added by the class template UT_Engine (see UT_engine.h), which
+ is what a port instantiates. The engine does not depend on mbed.
+
+ ********************************************************************/
+#ifndef _CORE_
+#define _CORE_
+
+#include "UT_config.h"
+#include "UT_port.h"
+#include "UT_CANMessage.h"
+
+#include "UT_frontend.h"
+#include "UT_rxbuffer.h"
+#include "UT_swfilter.h"
+#include "UT_canfilter.h"
+#include "UT_txbuffer.h"
+#include "UT_binary.h"
+#include "UT_gateway.h"
+#include "UT_perf.h"
+#include "UT_cyclic.h"
+#include "UT_change.h"
+#include "UT_ratelimit.h"
+#include "UT_busstats.h"
+#include "UT_isotp.h"
+#include "UT_replay.h"
+#include "UT_sched.h"
+#include "UT_timestamp.h"
+#include "UT_txqueue.h"
+
+// large buffers, placed by the port (PORT_BULK0/PORT_BULK1 on the
+// device, one 16 KB RAM bank each)
+typedef struct
+{
+    unsigned char isotp_tx[ISOTP_MAXLINKS][ISOTP_MAXPDU];
+    replay_record_t replay[REPLAY_BUFFERSIZE];
+} device_bulk0_t;
+
+typedef struct
+{
+    unsigned char isotp_rx[ISOTP_MAXLINKS][ISOTP_MAXPDU];
+} device_bulk1_t;
+
+class UT_Device {
+public:
+    UT_Device(char * txbuf, unsigned short txsize, unsigned short rxsize,
+            unsigned char timestamps, device_bulk0_t & bulk0, device_bulk1_t & bulk1);
+
+    void tick(void);
+    unsigned char tickActive(void);
+    void timer(void);
+
+    void rxClearStats(unsigned char channel);
+    unsigned char rxTakeOverrun(unsigned char channel);
+
+    // command line interface, UT_frontend.cpp
+    void parseLine(char * line);
+    unsigned char transmitStd(unsigned char channel, char * line);
+    void sendHex(unsigned long value, unsigned char len);
+    void sendByteHex(unsigned char value);
+
+    // port access, implemented by UT_Engine for its ports
+    virtual uint32_t micros(void) = 0;
+    virtual void timerStart(uint32_t delay_us) = 0;
+    virtual void signal(int32_t signals) = 0;
+    virtual void serialWrite(const char * buf, unsigned short len) = 0;
+    virtual unsigned char canFrequency(unsigned char channel, unsigned long hz) = 0;
+    virtual void canOpen(unsigned char channel, unsigned char mode) = 0;
+    virtual void canClose(unsigned char channel) = 0;
+    virtual unsigned char canSendFromIsr(unsigned char channel, canmsg_t * canmsg) = 0;
+    virtual unsigned char canSetFilter(const idrange_t * std, unsigned short std_count,
+            const idrange_t * ext, unsigned short ext_count) = 0;
+    virtual unsigned short rxFilled(unsigned char channel) = 0;
+
+    unsigned char state[USBTIN_CHANNELS];           // STATE_*
+    volatile rxbuffer_stats_t rxstats[USBTIN_CHANNELS];
+    unsigned long serialBaud;       // link rate requested with 'U', applied after the response
+    const unsigned short rxsize;    // receive buffer depth in frames
+
+    UT_Timestamp timestamp;
+    UT_SwFilter swfilter;
+    UT_CanFilter canfilter;
+    UT_Gateway gateway;
+    UT_Cyclic cyclic;
+    UT_Isotp isotp;
+    UT_Replay replay;
+    UT_RateLimit ratelimit;
+    UT_Change change;
+    UT_BusStats busstats;
+    UT_TxQueue txqueue;
+    UT_Sched sched;
+    UT_Binary binary;
+    UT_TxBuffer txbuffer;
+#if USBTIN_PERF
+    UT_Perf perf;
+#endif
+
+protected:
+    unsigned short receive(char * data, unsigned short len, unsigned char more);
+    void parseCommand(char * cmd);
+
+    // command lines handled in the current pass
+    unsigned short commands;
+
+private:
+    // buffer for incoming characters of lines that can't be parsed in place
+    char line[LINE_MAXLEN];
+    unsigned char linepos;
+    unsigned char lineoverflow;
+
+    // set while the hex data of an ISO-TP PDU ("XL...") is streamed
+    unsigned char pdumode;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/********************************************************************
+ File: UT_cyclic.cpp
+
+ Description:
+ This file contains the cyclic transmit scheduler functions.
+ Each wheel slot holds a list of the frames due in that tick. The
+ tick handler takes the list of the current slot, queues the frames
+ whose revolutions are used up and files every frame again one
+ period ahead. Tick times come from the port's hardware timer, so
+ periods don't drift; jitter is the interrupt and bus latency.
+
+ The tick runs in interrupt context at the priority of the CAN
+ interrupt. The thread changes the table with PORT_CAN_LOCK(), which
+ masks both.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_cyclic.h"
+
+#include "UT_core.h"
+
+#if (CYCLIC_WHEEL_SIZE & (CYCLIC_WHEEL_SIZE - 1)) || (CYCLIC_WHEEL_SIZE > 256)
+#error "CYCLIC_WHEEL_SIZE must be a power of two not greater than 256"
+#endif
+
+#if (1000 % CYCLIC_TICK_US) || (CYCLIC_MAXFRAMES > 255)
+#error "CYCLIC_TICK_US must divide 1000 and CYCLIC_MAXFRAMES must be below 256"
+#endif
+
+#define CYCLIC_WHEEL_MASK (CYCLIC_WHEEL_SIZE - 1)
+#define CYCLIC_TICKS_PER_MS (1000 / CYCLIC_TICK_US)
+#define CYCLIC_NONE 0xFF
+
+UT_Cyclic::UT_Cyclic(UT_Device & dev) : dev(dev) {
+    reset();
+}
+
+/**
+ * File entry into the wheel
+ *
+ * @param index Entry index
+ * @param delay Ticks from the current slot, at least 1
+ */
+void UT_Cyclic::schedule(unsigned char index, unsigned long delay) {
+    cyclic_entry_t * entry = &entries[index];
+    unsigned char slot = (wheelpos + delay) & CYCLIC_WHEEL_MASK;
+
+    entry->rounds = (delay - 1) / CYCLIC_WHEEL_SIZE;
+    entry->slot = slot;
+    entry->next = wheel[slot];
+    wheel[slot] = index;
+}
+
+/**
+ * Take entry out of its wheel slot
+ *
+ * @param index Entry index
+ */
+void UT_Cyclic::unschedule(unsigned char index) {
+    unsigned char * link = &wheel[entries[index].slot];
+
+    while (*link != CYCLIC_NONE) {
+        if (*link == index) {
+            *link = entries[index].next;
+            return;
+        }
+        link = &entries[*link].next;
+    }
+}
+
+/**
+ * Remove all entries
+ */
+void UT_Cyclic::reset(void) {
+    memset(wheel, CYCLIC_NONE, sizeof(wheel));
+    memset(entries, 0, sizeof(entries));
+    wheelpos = 0;
+    count = 0;
+}
+
+/**
+ * Register or replace cyclic frame. It is sent first on the next tick.
+ *
+ * @param index Entry index
+ * @param channel Channel to transmit on
+ * @param period_ms Period in ms, at least 1
+ * @param canmsg Frame to send
+ * @return 1 on success, 0 on invalid arguments
+ */
+unsigned char UT_Cyclic::add(unsigned char index, unsigned char channel,
+        unsigned short period_ms, canmsg_t * canmsg) {
+    if ((index >= CYCLIC_MAXFRAMES) || (channel >= USBTIN_CHANNELS) || (period_ms == 0))
+        return 0;
+
+    PORT_CAN_LOCK();
+    if (entries[index].period)
+        unschedule(index);
+    else
+        count++;
+    entries[index].canmsg = *canmsg;
+    entries[index].channel = channel;
+    entries[index].period = (unsigned long) period_ms * CYCLIC_TICKS_PER_MS;
+    schedule(index, 1);
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Change payload bytes of a cyclic frame in place, the schedule is kept
+ *
+ * @param index Entry index
+ * @param offset First data byte to change
+ * @param data New data bytes
+ * @param len Count of data bytes
+ * @return 1 on success, 0 if the entry is unused or the range exceeds its dlc
+ */
+unsigned char UT_Cyclic::update(unsigned char index, unsigned char offset,
+        const unsigned char * data, unsigned char len) {
+    if ((index >= CYCLIC_MAXFRAMES) || !entries[index].period)
+        return 0;
+
+    // DLC 9..15 still carry 8 bytes
+    unsigned char length = entries[index].canmsg.dlc;
+    if (length > 8)
+        length = 8;
+    if (offset + len > length)
+        return 0;
+
+    PORT_CAN_LOCK();
+    memcpy(&entries[index].canmsg.data[offset], data, len);
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Stop sending a cyclic frame
+ *
+ * @param index Entry index
+ * @return 1 on success, 0 if the entry is unused
+ */
+unsigned char UT_Cyclic::remove(unsigned char index) {
+    if ((index >= CYCLIC_MAXFRAMES) || !entries[index].period)
+        return 0;
+
+    PORT_CAN_LOCK();
+    unschedule(index);
+    entries[index].period = 0;
+    count--;
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Stop sending all cyclic frames
+ */
+void UT_Cyclic::clear(void) {
+    PORT_CAN_LOCK();
+    reset();
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Check for registered frames. Ports may stop ticking without them.
+ *
+ * @return 1 if at least one frame is registered
+ */
+unsigned char UT_Cyclic::active(void) {
+    return count != 0;
+}
+
+/**
+ * Advance the wheel by one slot and queue due frames.
+ * Called by the port every CYCLIC_TICK_US in interrupt context.
+ * Frames of closed channels or with a full transmit queue are skipped
+ * for this period.
+ */
+void UT_Cyclic::tick(void) {
+    wheelpos = (wheelpos + 1) & CYCLIC_WHEEL_MASK;
+
+    unsigned char index = wheel[wheelpos];
+    wheel[wheelpos] = CYCLIC_NONE;
+
+    while (index != CYCLIC_NONE) {
+        cyclic_entry_t * entry = &entries[index];
+        unsigned char next = entry->next;
+
+        if (entry->rounds) {
+            entry->rounds--;
+            entry->next = wheel[wheelpos];
+            wheel[wheelpos] = index;
+        } else {
+            if (dev.state[entry->channel] == STATE_OPEN)
+                dev.txqueue.putFromIsr(entry->channel, &entry->canmsg);
+            schedule(index, entry->period);
+        }
+        index = next;
+    }
+}
@@ -0,0 +1,70 @@
+/********************************************************************
+ File: UT_cyclic.h
+
+ Description:
+ This file contains the cyclic transmit scheduler definitions.
+ Periodic frames are kept on the device in a timer wheel and queued
+ for transmission from the port's tick interrupt, so the host only
+ registers them once and afterwards sends payload changes.
+
+ ********************************************************************/
+#ifndef _CYCLIC_
+#define _CYCLIC_
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+#ifndef CYCLIC_MAXFRAMES
+#define CYCLIC_MAXFRAMES 32
+#endif
+
+// tick interval of the port, must divide one millisecond
+#ifndef CYCLIC_TICK_US
+#define CYCLIC_TICK_US 1000
+#endif
+
+// wheel slots, one per tick; longer periods take several revolutions
+#ifndef CYCLIC_WHEEL_SIZE
+#define CYCLIC_WHEEL_SIZE 128
+#endif
+
+typedef struct
+{
+    canmsg_t canmsg;
+    unsigned long period;       // ticks, 0 if the entry is unused
+    unsigned long rounds;       // wheel revolutions left until due
+    unsigned char channel;
+    unsigned char slot;         // wheel slot the entry is filed in
+    unsigned char next;         // next entry in the same slot
+} cyclic_entry_t;
+
+class UT_Device;
+
+class UT_Cyclic {
+public:
+    UT_Cyclic(UT_Device & dev);
+
+    unsigned char add(unsigned char index, unsigned char channel,
+            unsigned short period_ms, canmsg_t * canmsg);
+    unsigned char update(unsigned char index, unsigned char offset,
+            const unsigned char * data, unsigned char len);
+    unsigned char remove(unsigned char index);
+    void clear(void);
+
+    unsigned char active(void);
+    void tick(void);
+
+private:
+    void reset(void);
+    void schedule(unsigned char index, unsigned long delay);
+    void unschedule(unsigned char index);
+
+    UT_Device & dev;
+
+    cyclic_entry_t entries[CYCLIC_MAXFRAMES];
+    unsigned char wheel[CYCLIC_WHEEL_SIZE];
+    unsigned char wheelpos;
+    volatile unsigned char count;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/********************************************************************
+ File: UT_engine.h
+
+ Description:
+ This file contains the protocol engine class template. An engine is
+ UT_Device bound to a CAN port, a serial port and a clock (see
+ UT_port.h) and to a constant configuration:
+
+   class Config
+   {
+   public:
+       static constexpr unsigned short rxBufferSize = ...;   // frames, power of two
+       static constexpr unsigned short txBufferSize = ...;   // serial output batch, bytes
+       static constexpr unsigned char overflowPolicy = ...;  // OVERFLOW_*
+       static constexpr unsigned char timestamps = ...;      // 0 compiles time stamping out
+   };
+
+ The receive path, the timestamps and the main loop pass are
+ compiled for the ports given, so their calls into the ports are
+ inlined and the branches a configuration doesn't need are dropped.
+ Command handling and the feature modules don't depend on the ports
+ and are shared by all instantiations; they reach the ports through
+ the virtual functions of UT_Device.
+
+ Each instance has its own state, so a port may run several engines,
+ for example one per host link.
+
+ ********************************************************************/
+#ifndef _ENGINE_
+#define _ENGINE_
+
+#if __cplusplus < 201103L
+#error "the engine template needs C++11 (-std=gnu++11)"
+#endif
+
+#include "UT_core.h"
+
+// configuration built from the compile time defaults
+class UT_DefaultConfig {
+public:
+    static constexpr unsigned short rxBufferSize = CANMSG_BUFFERSIZE;
+    static constexpr unsigned short txBufferSize = TXBUFFER_SIZE;
+    static constexpr unsigned char overflowPolicy = CANMSG_OVERFLOW_POLICY;
+    static constexpr unsigned char timestamps = USBTIN_TIMESTAMPS;
+};
+
+template <class CanPort, class SerialPort, class Clock, class Config>
+class UT_Engine : public UT_Device {
+public:
+    static_assert(Config::txBufferSize >= BIN_ENCODED_MAXLEN,
+        "txBufferSize too small for BIN_PAYLOAD_MAXLEN");
+
+    UT_Engine(CanPort & can, SerialPort & serial, Clock & clock,
+            device_bulk0_t & bulk0, device_bulk1_t & bulk1)
+            : UT_Device(txbuf, Config::txBufferSize, Config::rxBufferSize,
+                Config::timestamps, bulk0, bulk1),
+              rx(rxstats), can(can), serial(serial), clock(clock) {
+    }
+
+    /**
+     * Get storage for the next frame received on given channel (CAN
+     * interrupt). The port reads the frame into it and hands it to
+     * canReceive(); while the receive buffer has room it is the next
+     * buffer slot, so accepted frames are not copied again.
+     *
+     * @param channel Channel index
+     * @return Frame storage, valid until the next call
+     */
+    canmsg_t * canReceiveSlot(unsigned char channel) {
+        canmsg_t * slot = rx.peekWritePtr(channel);
+        return (slot != NULL) ? slot : &scratch;
+    }
+
+    /**
+     * Get the timestamp for frames received now (CAN interrupt)
+     *
+     * @return Timestamp in the format selected by 'Z', 0 if off
+     */
+    unsigned long rxTimestamp(void) {
+        return Config::timestamps ? timestamp.capture(clock.micros()) : 0;
+    }
+
+    /**
+     * Handle a frame received on given channel (CAN interrupt).
+     * Frames are discarded while the channel is closed. Bus statistics
+     * count all other frames. Frames of ISO-TP links are consumed,
+     * otherwise gateway routes are applied first, then the software
+     * filter, rate limiting and the change-only mode decide about
+     * delivery to the host. Rate limiting and the change-only mode only
+     * account for frames that made it into the receive buffer.
+     *
+     * @param channel Channel index
+     * @param canmsg Received frame with timestamp
+     */
+    void canReceive(unsigned char channel, canmsg_t * canmsg) {
+        PERF_BEGIN(start);
+        PERF_COUNT(perf, channel, rx);
+
+        if (state[channel] == STATE_CONFIG) {
+            PERF_COUNT(perf, channel, dropped_closed);
+            return;
+        }
+
+        uint32_t now = clock.micros();
+        if (busstats.enabled)
+            busstats.receive(channel, canmsg, now);
+
+        if (!isotp.receive(channel, canmsg)
+                && gateway.forward(channel, canmsg)
+                && swfilter.accept(canmsg->id, canmsg->extended)
+                && ratelimit.accept(channel, canmsg, now)
+                && change.accept(channel, canmsg, now)) {
+            if (rx.put(channel, canmsg)) {
+                ratelimit.delivered(now);
+                change.delivered(channel, canmsg, now);
+                clock.signal(UT_SIGNAL_CANRX);
+            }
+        }
+
+        PERF_END(perf, PERF_CANRX, start);
+    }
+
+    /**
+     * Count frames lost in the controller of given channel (CAN interrupt)
+     *
+     * @param channel Channel index
+     */
+    void canOverrun(unsigned char channel) {
+        if (state[channel] != STATE_CONFIG)
+            rx.countOverrun(channel);
+    }
+
+    /**
+     * Characters from the host were put into the serial receive ring.
+     * Called by the port from the serial receive interrupt.
+     */
+    void serialReceived(void) {
+        sched.inputArrived(clock.micros());
+    }
+
+    /**
+     * One pass of the main loop. The port calls it whenever it was
+     * signalled and at least every UT_IDLE_TIMEOUT ms.
+     * Complete commands received so far are handled first, up to the
+     * command budget, so pipelined transmit commands reach the queues in
+     * one pass. Their responses and the received frames, up to the frame
+     * budget, are collected in the output buffer and sent out together.
+     * Work left for the next pass signals the thread again (see
+     * UT_sched.h).
+     */
+    void process(void) {
+        canmsg_t * canmsg;
+        unsigned char channel;
+        unsigned char busy;
+        unsigned short frames;
+        char * data;
+        unsigned char more;
+        unsigned short len;
+
+        // handle the characters received from the host in place, stop at
+        // a line that has not been received completely
+        sched.inputBegin();
+        commands = 0;
+        while ((len = serial.peek(&data, &more)) > 0) {
+            unsigned short n = receive(data, len, more);
+            serial.consume(n);
+            if (n < len)
+                break;
+        }
+        if (sched.config.cmd_budget && (commands >= sched.config.cmd_budget)
+                && (serial.peek(&data, &more) > 0)) {
+            sched.stats.cmd_yields++;
+            clock.signal(UT_SIGNAL_SERIALRX);
+        }
+
+        isotp.poll();
+        replay.poll();
+
+        // keep the millisecond clock running on a quiet bus
+        unsigned char stamping = TIMESTAMP_OFF;
+        if (Config::timestamps) {
+            PORT_CAN_LOCK();
+            timestamp.advance(clock.micros());
+            PORT_CAN_UNLOCK();
+            stamping = timestamp.mode;
+        }
+
+        // process can messages in receive buffers: encode whole lines
+        // into the output buffer, taking one message per channel in turn
+        frames = 0;
+        do {
+            busy = 0;
+            for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+                if ((canmsg = rx.getReadPtr(channel)) == NULL)
+                    continue;
+                PERF_BEGIN(start);
+                unsigned long stamp = (stamping != TIMESTAMP_OFF)
+                    ? timestamp.expand(canmsg->timestamp, clock.micros()) : 0;
+                if (binary.mode) {
+                    binary.putFrame(channel, canmsg, stamping, stamp);
+                } else {
+                    char * buf = txbuffer.reserve(CANMSG_ASCII_MAXLEN);
+                    txbuffer.commit(canmsg2ascii(channel, canmsg, buf, stamping, stamp));
+                }
+                rx.release(channel);
+                PERF_END(perf, PERF_ENCODE, start);
+                PERF_COUNT(perf, channel, host);
+                frames++;
+                busy = 1;
+            }
+            if (busy && sched.rxYield(frames)) {
+                clock.signal(UT_SIGNAL_CANRX);
+                break;
+            }
+        } while (busy);
+        binary.flush();
+        txbuffer.flush();
+
+        // a new link rate applies once the response has been sent
+        if (serialBaud) {
+            serial.setBaud(serialBaud);
+            serialBaud = 0;
+        }
+    }
+
+    // port access for the shared engine code
+    uint32_t micros(void) {
+        return clock.micros();
+    }
+
+    void timerStart(uint32_t delay_us) {
+        clock.timerStart(delay_us);
+    }
+
+    void signal(int32_t signals) {
+        clock.signal(signals);
+    }
+
+    void serialWrite(const char * buf, unsigned short len) {
+        serial.write(buf, len);
+    }
+
+    unsigned char canFrequency(unsigned char channel, unsigned long hz) {
+        return can.frequency(channel, hz);
+    }
+
+    void canOpen(unsigned char channel, unsigned char mode) {
+        can.open(channel, mode);
+    }
+
+    void canClose(unsigned char channel) {
+        can.close(channel);
+    }
+
+    unsigned char canSendFromIsr(unsigned char channel, canmsg_t * canmsg) {
+        return can.sendFromIsr(channel, canmsg);
+    }
+
+    unsigned char canSetFilter(const idrange_t * std, unsigned short std_count,
+            const idrange_t * ext, unsigned short ext_count) {
+        return can.setFilter(std, std_count, ext, ext_count);
+    }
+
+    unsigned short rxFilled(unsigned char channel) {
+        return rx.filled(channel);
+    }
+
+private:
+    UT_RxBuffer<Config::rxBufferSize, Config::overflowPolicy> rx;
+
+    // frame storage of the receive interrupt while the receive buffer is full
+    canmsg_t scratch;
+
+    char txbuf[Config::txBufferSize];
+
+    CanPort & can;
+    SerialPort & serial;
+    Clock & clock;
+};
+
+#endif
@@ -18,185 +18,460 @@ this source code.
 
  ********************************************************************/
 
+#include <string.h>
+
 #include "UT_frontend.h"
+#include "UT_hex.h"
 
-#include "mbed.h"
+#include "UT_core.h"
 
-#include "USBtin.h"
+// 'U' rates: 0..6 as the LAWICEL CANUSB, 7..9 added
+static const unsigned long serialBauds[] = {
+    230400, 115200, 57600, 38400, 19200, 9600, 2400, 460800, 921600, 1500000
+};
 
-unsigned char timestamping = 0;
+/**
+ * Queue given value as hexadecimal string for sending
+ *
+ * @param value Value to send as hex over the UART
+ * @param len Count of characters to produce
+ */
+void UT_Device::sendHex(unsigned long value, unsigned char len) {
+    hex_encode(txbuffer.reserve(len), value, len);
+    txbuffer.commit(len);
+}
 
-unsigned char deviceState;
+/**
+ * Queue given byte value as hexadecimal string for sending
+ *
+ * @param value Byte value to send over UART
+ */
+void UT_Device::sendByteHex(unsigned char value) {
+    hex_encodeByte(txbuffer.reserve(2), value);
+    txbuffer.commit(2);
+}
 
 /**
- * Parse hex value of given string
+ * Interprets given transmit command (t, T, r or R)
  *
- * @param line Input string
- * @param len Count of characters to interpret
- * @param value Pointer to variable for the resulting decoded value
- * @return 0 on error, 1 on success
+ * @param line Line string which contains the transmit command
+ * @param canmsg Output can message
+ * @return 1 on success, 0 on parse error
  */
-unsigned char parseHex(char * line, unsigned char len, unsigned long * value) {
-    *value = 0;
-    while (len--) {
-        if (*line == 0)
-            return 0;
-        *value <<= 4;
-        if ((*line >= '0') && (*line <= '9')) {
-            *value += *line - '0';
-        } else if ((*line >= 'A') && (*line <= 'F')) {
-            *value += *line - 'A' + 10;
-        } else if ((*line >= 'a') && (*line <= 'f')) {
-            *value += *line - 'a' + 10;
-        } else
+unsigned char parseFrame(char * line, canmsg_t * canmsg) {
+    unsigned long temp;
+    unsigned char idlen;
+
+    if ((line[0] != 't') && (line[0] != 'T') && (line[0] != 'r') && (line[0] != 'R'))
+        return 0;
+
+    canmsg->rtr = ((line[0] == 'r') || (line[0] == 'R'));
+
+    // upper case -> extended identifier
+    if (line[0] < 'Z') {
+        canmsg->extended = 1;
+        idlen = 8;
+    } else {
+        canmsg->extended = 0;
+        idlen = 3;
+    }
+
+    if (!hex_decode(&line[1], idlen, &temp))
+        return 0;
+    canmsg->id = temp;
+
+    if (!hex_decode(&line[1 + idlen], 1, &temp))
+        return 0;
+    canmsg->dlc = temp;
+
+    if (!canmsg->rtr) {
+        unsigned char length = canmsg->dlc;
+        if (length > 8)
+            length = 8;
+        if (!hex_decodeBytes(&line[idlen + 2], canmsg->data, length))
             return 0;
-        line++;
     }
+
     return 1;
 }
 
 /**
- * Send given value as hexadecimal string
+ * Interprets given line and queues can message for transmission
  *
- * @param value Value to send as hex over the UART
- * @param len Count of characters to produce
+ * @param channel Channel to transmit on
+ * @param line Line string which contains the transmit command
+ * @return 1 if queued, 0 on parse error or full transmit queue
  */
-void sendHex(unsigned long value, unsigned char len) {
-
-    uint8_t s[20];
-    s[len] = 0;
+unsigned char UT_Device::transmitStd(unsigned char channel, char * line) {
+    canmsg_t canmsg;
 
-    while (len--) {
+    if (!parseFrame(line, &canmsg))
+        return 0;
 
-        unsigned char hex = value & 0x0f;
-        if (hex > 9)
-            hex = hex - 10 + 'A';
-        else
-            hex = hex + '0';
-        s[len] = hex;
+    return txqueue.put(channel, &canmsg);
+}
 
-        value = value >> 4;
-        USBTIN_serialPort->putc(s[len]);
-    }
+/**
+ * Check if all channels are closed. The acceptance filter is shared,
+ * it is only changed and loaded into the controllers then.
+ *
+ * @return 1 if no channel is open
+ */
+static unsigned char channelsClosed(UT_Device & dev) {
+    unsigned char channel;
 
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++)
+        if (dev.state[channel] != STATE_CONFIG)
+            return 0;
+    return 1;
 }
 
 /**
- * Send given byte value as hexadecimal string
+ * Parse given rate limiting rule "siiijjjNNNNtttt" or
+ * "eiiiiiiiijjjjjjjjNNNNtttt" (format, id range, divisor, interval in
+ * ms), "c" clears all rules
  *
- * @param value Byte value to send over UART
+ * @param channel Channel the rule applies to
+ * @param line Line string without command character
+ * @return 1 on success
  */
-void sendByteHex(unsigned char value) {
+static unsigned char parseRateLimit(UT_Device & dev, unsigned char channel, char * line) {
+    ratelimit_rule_t rule;
+    unsigned long divisor, interval;
+    unsigned char idlen;
 
-    //    sendHex(value, 2);
+    if ((line[0] == 'c') && (line[1] == 0)) {
+        dev.ratelimit.clear();
+        return 1;
+    }
+    if ((line[0] != 's') && (line[0] != 'e'))
+        return 0;
 
-    unsigned char ch = value >> 4;
-    if (ch > 9)
-        ch = ch - 10 + 'A';
-    else
-        ch = ch + '0';
-    USBTIN_serialPort->putc(ch);
+    idlen = (line[0] == 'e') ? 8 : 3;
+    if (!hex_decode(&line[1], idlen, &rule.lo) || !hex_decode(&line[1 + idlen], idlen, &rule.hi)
+            || !hex_decode(&line[1 + 2 * idlen], 4, &divisor)
+            || !hex_decode(&line[5 + 2 * idlen], 4, &interval))
+        return 0;
+    if (rule.hi > ((idlen == 3) ? 0x7FFUL : 0x1FFFFFFFUL))
+        return 0;
 
-    ch = value & 0xF;
-    if (ch > 9)
-        ch = ch - 10 + 'A';
-    else
-        ch = ch + '0';
-    USBTIN_serialPort->putc(ch);
+    rule.channel = channel;
+    rule.extended = (idlen == 8);
+    rule.divisor = divisor;
+    rule.interval = interval;
+    return dev.ratelimit.add(&rule);
+}
+
+/**
+ * Parse given ISO-TP link command "LFiiiiiiiijjjjjjjjbbss" (link,
+ * ISOTP_* flags, transmit id, receive id, block size and STmin of our
+ * flow control), "L" alone closes the link
+ *
+ * @param channel Channel of the link
+ * @param line Line string without command character
+ * @return 1 on success
+ */
+static unsigned char parseIsotp(UT_Device & dev, unsigned char channel, char * line) {
+    unsigned long link, flags, txid, rxid, bs, stmin;
 
+    if (!hex_decode(&line[0], 1, &link))
+        return 0;
+    if (line[1] == 0)
+        return dev.isotp.close(link);
+    if (!hex_decode(&line[1], 1, &flags) || !hex_decode(&line[2], 8, &txid)
+            || !hex_decode(&line[10], 8, &rxid) || !hex_decode(&line[18], 2, &bs)
+            || !hex_decode(&line[20], 2, &stmin))
+        return 0;
+    return dev.isotp.open(link, channel, flags, txid, rxid, bs, stmin);
 }
 
 /**
- * Interprets given line and transmit can message
+ * Parse given replay command: "foooooooo" followed by a transmit
+ * command appends a frame with its offset in us, "s" starts the
+ * replay, "e" marks the end of the trace, "c" stops and discards it
+ * and "q" returns the status (see UT_Replay::sendStatus())
  *
- * @param line Line string which contains the transmit command
+ * @param channel Channel to transmit on
+ * @param line Line string without command character
+ * @return 1 on success
  */
-unsigned char transmitStd(char *line) {
+static unsigned char parseReplay(UT_Device & dev, unsigned char channel, char * line) {
     canmsg_t canmsg;
-    unsigned long temp;
-    unsigned char idlen;
+    unsigned long offset;
 
-    canmsg.flags.rtr = ((line[0] == 'r') || (line[0] == 'R'));
+    switch (line[0]) {
+        case 'f':
+            if (!hex_decode(&line[1], 8, &offset) || !parseFrame(&line[9], &canmsg))
+                return 0;
+            return dev.replay.put(channel, offset, &canmsg);
+        case 's':
+            return dev.replay.start();
+        case 'e':
+            return dev.replay.end();
+        case 'c':
+            dev.replay.clear();
+            return 1;
+        case 'q':
+            dev.replay.sendStatus();
+            return 1;
+    }
+    return 0;
+}
 
-    // upper case -> extended identifier
-    if (line[0] < 'Z') {
-        canmsg.flags.extended = 1;
-        idlen = 8;
-    } else {
-        canmsg.flags.extended = 0;
-        idlen = 3;
+/**
+ * Parse given scheduler command: "wRRRRCCCCYYYY" sets the frame and
+ * command budgets per pass and the yield time in us (0 for no limit),
+ * "s" returns the status, "c" clears the latency statistics
+ *
+ * @param line Line string without command character
+ * @return 1 on success
+ */
+static unsigned char parseSched(UT_Device & dev, char * line) {
+    unsigned long rx, cmd, yield;
+
+    switch (line[0]) {
+        case 'w':
+            if (!hex_decode(&line[1], 4, &rx) || !hex_decode(&line[5], 4, &cmd)
+                    || !hex_decode(&line[9], 4, &yield))
+                return 0;
+            dev.sched.config.rx_budget = rx;
+            dev.sched.config.cmd_budget = cmd;
+            dev.sched.config.yield_us = yield;
+            return 1;
+        case 's':
+            dev.sched.sendStatus();
+            return 1;
+        case 'c':
+            dev.sched.clear();
+            return 1;
     }
+    return 0;
+}
 
-    if (!parseHex(&line[1], idlen, &temp))
+/**
+ * Parse given cyclic frame command "NNpppp" followed by a transmit
+ * command (entry, period in ms), "NN" alone removes the entry and an
+ * empty line removes all entries
+ *
+ * @param channel Channel to transmit on
+ * @param line Line string without command character
+ * @return 1 on success
+ */
+static unsigned char parseCyclic(UT_Device & dev, unsigned char channel, char * line) {
+    canmsg_t canmsg;
+    unsigned long index, period;
+
+    if (line[0] == 0) {
+        dev.cyclic.clear();
+        return 1;
+    }
+    if (!hex_decode(&line[0], 2, &index))
         return 0;
-    canmsg.id = temp;
+    if (line[2] == 0)
+        return dev.cyclic.remove(index);
+    if (!hex_decode(&line[2], 4, &period) || !parseFrame(&line[6], &canmsg))
+        return 0;
+    return dev.cyclic.add(index, channel, period, &canmsg);
+}
 
-    if (!parseHex(&line[1 + idlen], 1, &temp))
+/**
+ * Parse given cyclic payload update "NNodd.." (entry, first data
+ * byte, new data bytes)
+ *
+ * @param line Line string without command character
+ * @return 1 on success
+ */
+static unsigned char parseCyclicUpdate(UT_Device & dev, char * line) {
+    unsigned char data[8];
+    unsigned long index, offset;
+
+    // hex_decode stops at the terminator, so line[3] is in the string
+    if (!hex_decode(&line[0], 2, &index) || !hex_decode(&line[2], 1, &offset))
+        return 0;
+    size_t chars = strlen(&line[3]);
+    if ((chars == 0) || (chars & 1) || (chars > 2 * sizeof(data))
+            || !hex_decodeBytes(&line[3], data, chars / 2))
         return 0;
-    canmsg.dlc = temp;
+    return dev.cyclic.update(index, offset, data, chars / 2);
+}
 
-    if (!canmsg.flags.rtr) {
-        unsigned char i;
-        unsigned char length = canmsg.dlc;
-        if (length > 8)
-            length = 8;
-        for (i = 0; i < length; i++) {
-            if (!parseHex(&line[idlen + 2 + i * 2], 2, &temp))
+/**
+ * Set bit rate of given channel
+ *
+ * @param channel Channel index
+ * @param hz Bit rate
+ */
+static void setBitrate(UT_Device & dev, unsigned char channel, unsigned long hz) {
+    dev.canFrequency(channel, hz);
+    dev.busstats.setBitrate(channel, hz);
+}
+
+/**
+ * Queue bus statistics record of given table entry for sending:
+ * id (bit 31 set for extended ids), frames in the window, frames
+ * in total, last DLC and ms since the id was last received
+ *
+ * @param index Table index
+ */
+static void sendBusstatsEntry(UT_Device & dev, unsigned short index) {
+    volatile busstats_entry_t * entry = &dev.busstats.table[index];
+    unsigned long id = entry->key & 0x1FFFFFFF;
+
+    if (entry->key & IDHASH_KEY_EXTENDED)
+        id |= 0x80000000UL;
+    dev.sendHex(id, 8);
+    dev.sendHex(entry->count - entry->base, 8);
+    dev.sendHex(entry->count, 8);
+    dev.sendHex(entry->dlc, 1);
+    dev.sendHex((uint32_t) (dev.micros() - entry->last_us) / 1000, 8);
+}
+
+/**
+ * Parse given bus statistics command and queue the response: "m0"/"m1"
+ * switch statistics off/on, "s" returns the summary and starts a new
+ * window, "tNN" returns the NN ids with the most frames in the window,
+ * "t00" all ids
+ *
+ * @param channel Channel index
+ * @param line Line string without command character
+ * @return 1 on success
+ */
+static unsigned char parseBusstats(UT_Device & dev, unsigned char channel, char * line) {
+    unsigned long value;
+    uint32_t elapsed;
+    unsigned short load;
+    unsigned short i;
+
+    switch (line[0]) {
+        case 'm':
+            if (!hex_decode(&line[1], 1, &value) || (value > 1))
                 return 0;
-            canmsg.data[i] = temp;
-        }
+            dev.busstats.enable(value);
+            return 1;
+        case 's':
+            {
+                volatile busstats_channel_t * stats = &dev.busstats.channels[channel];
+                if (!dev.busstats.enabled)
+                    return 0;
+                dev.busstats.window(channel, &elapsed, &load);
+                dev.busstats.restart(channel);
+                dev.txbuffer.putc('i');
+                dev.sendHex(elapsed, 8);
+                dev.sendHex(load, 4);
+                dev.sendHex(stats->frames, 8);
+                dev.sendHex(stats->untracked, 8);
+                for (i = 0; i < 9; i++)
+                    dev.sendHex(stats->dlc[i], 8);
+            }
+            return 1;
+        case 't':
+            {
+                unsigned short index[BUSSTATS_TOPMAX];
+                unsigned short n;
+                if (!dev.busstats.enabled || !hex_decode(&line[1], 2, &value) || (value > BUSSTATS_TOPMAX))
+                    return 0;
+                dev.busstats.window(channel, &elapsed, &load);
+                dev.txbuffer.putc('i');
+                dev.sendHex(elapsed, 8);
+                if (value == 0) {
+                    for (i = 0; i < BUSSTATS_TABLE_SIZE; i++) {
+                        uint32_t key = dev.busstats.table[i].key;
+                        if ((key != 0) && (((key & IDHASH_KEY_CHANNEL) != 0) == (channel != 0)))
+                            sendBusstatsEntry(dev, i);
+                    }
+                } else {
+                    n = dev.busstats.top(channel, index, value);
+                    for (i = 0; i < n; i++)
+                        sendBusstatsEntry(dev, index[i]);
+                }
+            }
+            return 1;
     }
+    return 0;
+}
+
+/**
+ * Parse given gateway route command "SDFiiiiiiiimmmmmmmmrrrrrrrrwwwwwwww"
+ * (source, destination, flags, id, mask, rewrite id, rewrite mask)
+ *
+ * @param line Line string without command character
+ * @return 1 if the route was added
+ */
+static unsigned char parseRoute(UT_Device & dev, char * line) {
+    gateway_route_t route;
+    unsigned long src, dst, flags;
+
+    if (!hex_decode(&line[0], 1, &src) || !hex_decode(&line[1], 1, &dst)
+            || !hex_decode(&line[2], 1, &flags)
+            || !hex_decode(&line[3], 8, &route.id) || !hex_decode(&line[11], 8, &route.mask)
+            || !hex_decode(&line[19], 8, &route.rwid) || !hex_decode(&line[27], 8, &route.rwmask))
+        return 0;
 
-    return USBTIN_CANport->write(toCANMessage(&canmsg));
+    route.src = src;
+    route.dst = dst;
+    route.flags = flags;
+    return dev.gateway.add(&route);
 }
 
 /**
- * Parse given command line
+ * Parse given command line.
+ * A leading digit selects the channel the command applies to,
+ * without it channel 0 is used.
  *
  * @param line Line string to parse
  */
-void parseLine(char * line) {
+void UT_Device::parseLine(char * line) {
 
     unsigned char result = BELL;
+    unsigned char channel = 0;
+
+    if ((line[0] >= '0') && (line[0] <= '9')) {
+        channel = line[0] - '0';
+        line++;
+    }
+    if (channel >= USBTIN_CHANNELS) {
+        txbuffer.putc(result);
+        return;
+    }
 
     switch (line[0]) {
         case 'S': // Setup with standard CAN bitrates
-            if (deviceState == STATE_CONFIG) {
+            if (state[channel] == STATE_CONFIG) {
                 switch (line[1]) {
                     case '0':
-                        USBTIN_CANport->frequency(10000);
+                        setBitrate(*this, channel, 10000);
                         result = CR;
                         break;
                     case '1':
-                        USBTIN_CANport->frequency(20000);
+                        setBitrate(*this, channel, 20000);
                         result = CR;
                         break;
                     case '2':
-                        USBTIN_CANport->frequency(50000);
+                        setBitrate(*this, channel, 50000);
                         result = CR;
                         break;
                     case '3':
-                        USBTIN_CANport->frequency(100000);
+                        setBitrate(*this, channel, 100000);
                         result = CR;
                         break;
                     case '4':
-                        USBTIN_CANport->frequency(125000);
+                        setBitrate(*this, channel, 125000);
                         result = CR;
                         break;
                     case '5':
-                        USBTIN_CANport->frequency(250000);
+                        setBitrate(*this, channel, 250000);
                         result = CR;
                         break;
                     case '6':
-                        USBTIN_CANport->frequency(500000);
+                        setBitrate(*this, channel, 500000);
                         result = CR;
                         break;
                     case '7':
-                        USBTIN_CANport->frequency(800000);
+                        setBitrate(*this, channel, 800000);
                         result = CR;
                         break;
                     case '8':
-                        USBTIN_CANport->frequency(1000000);
+                        setBitrate(*this, channel, 1000000);
                         result = CR;
                         break;
                 }
@@ -204,10 +479,10 @@ void parseLine(char * line) {
             }
             break;
         case 's': // Setup with user defined timing settings for CNF1/CNF2/CNF3
-            if (deviceState == STATE_CONFIG) {
+            if (state[channel] == STATE_CONFIG) {
                 unsigned long cnf1, cnf2, cnf3;
-                if (parseHex(&line[1], 2, &cnf1) && parseHex(&line[3], 2, &cnf2)
-                        && parseHex(&line[5], 2, &cnf3)) {
+                if (hex_decode(&line[1], 2, &cnf1) && hex_decode(&line[3], 2, &cnf2)
+                        && hex_decode(&line[5], 2, &cnf3)) {
                     // mcp2515_set_bittiming(cnf1, cnf2, cnf3);
                     result = CR;
                 }
@@ -216,7 +491,7 @@ void parseLine(char * line) {
         case 'G': // Read given MCP2515 register
             {
                 unsigned long address;
-                if (parseHex(&line[1], 2, &address)) {
+                if (hex_decode(&line[1], 2, &address)) {
                     // unsigned char value = mcp2515_read_register(address);
                     sendByteHex(0xFF);
                     result = CR;
@@ -226,7 +501,7 @@ void parseLine(char * line) {
         case 'W': // Write given MCP2515 register
             {
                 unsigned long address, data;
-                if (parseHex(&line[1], 2, &address) && parseHex(&line[3], 2, &data)) {
+                if (hex_decode(&line[1], 2, &address) && hex_decode(&line[3], 2, &data)) {
                     // mcp2515_write_register(address, data);
                     result = CR;
                 }
@@ -236,7 +511,7 @@ void parseLine(char * line) {
         case 'V': // Get hardware version
             {
 
-                USBTIN_serialPort->putc('V');
+                txbuffer.putc('V');
                 sendByteHex(VERSION_HARDWARE_MAJOR);
                 sendByteHex(VERSION_HARDWARE_MINOR);
                 result = CR;
@@ -245,7 +520,7 @@ void parseLine(char * line) {
         case 'v': // Get firmware version
             {
 
-                USBTIN_serialPort->putc('v');
+                txbuffer.putc('v');
                 sendByteHex(VERSION_FIRMWARE_MAJOR);
                 sendByteHex(VERSION_FIRMWARE_MINOR);
                 result = CR;
@@ -253,49 +528,60 @@ void parseLine(char * line) {
             break;
         case 'N': // Get serial number
             {
-                USBTIN_serialPort->putc('N');
+                txbuffer.putc('N');
                 /* USBTIN_serialPort->putc(USBSerial::deviceDesc()[7]);
                    USBTIN_serialPort->putc(USBTIN_serialPort->deviceDesc()[8]);
                    USBTIN_serialPort->putc(USBTIN_serialPort->deviceDesc()[9]);
                    USBTIN_serialPort->putc(USBTIN_serialPort->deviceDesc()[10]); */
-                USBTIN_serialPort->putc('F');
-                USBTIN_serialPort->putc('F');
-                USBTIN_serialPort->putc('F');
-                USBTIN_serialPort->putc('F');
+                txbuffer.putc('F');
+                txbuffer.putc('F');
+                txbuffer.putc('F');
+                txbuffer.putc('F');
                 result = CR;
             }
             break;
         case 'O': // Open CAN channel
-            if (deviceState == STATE_CONFIG) {
-                USBTIN_CANport->reset();
-
-                deviceState = STATE_OPEN;
+            if (state[channel] == STATE_CONFIG) {
+                if (channelsClosed(*this))
+                    canfilter.apply();
+                canOpen(channel, PORT_CAN_NORMAL);
+                txqueue.init(channel);
+                rxClearStats(channel);
+
+                state[channel] = STATE_OPEN;
                 result = CR;
             }
             break;
         case 'l': // Loop-back mode
-            if (deviceState == STATE_CONFIG) {
-                USBTIN_CANport->monitor(false);
-                USBTIN_CANport->reset();
-
-                deviceState = STATE_OPEN;
+            if (state[channel] == STATE_CONFIG) {
+                if (channelsClosed(*this))
+                    canfilter.apply();
+                canOpen(channel, PORT_CAN_NORMAL);
+                txqueue.init(channel);
+                rxClearStats(channel);
+
+                state[channel] = STATE_OPEN;
                 result = CR;
             }
             break;
         case 'L': // Open CAN channel in listen-only mode
-            if (deviceState == STATE_CONFIG) {
-                USBTIN_CANport->monitor(true); // set listen-only mode
-                USBTIN_CANport->reset();
-
-                deviceState = STATE_LISTEN;
+            if (state[channel] == STATE_CONFIG) {
+                if (channelsClosed(*this))
+                    canfilter.apply();
+                canOpen(channel, PORT_CAN_LISTEN); // set listen-only mode
+                txqueue.init(channel);
+                rxClearStats(channel);
+
+                state[channel] = STATE_LISTEN;
                 result = CR;
             }
             break;
         case 'C': // Close CAN channel
-            if (deviceState != STATE_CONFIG) {
-                USBTIN_CANport->reset();
+            if (state[channel] != STATE_CONFIG) {
+                canClose(channel);
+                txqueue.clear(channel);
 
-                deviceState = STATE_CONFIG;
+                state[channel] = STATE_CONFIG;
                 result = CR;
             }
             break;
@@ -303,12 +589,13 @@ void parseLine(char * line) {
         case 'R': // Transmit extended RTR (29 bit) frame
         case 't': // Transmit standard (11 bit) frame
         case 'T': // Transmit extended (29 bit) frame
-            if (deviceState == STATE_OPEN) {
-                if (transmitStd(line)) {
+            if (state[channel] == STATE_OPEN) {
+                if (transmitStd(channel, line)) {
+                    // 'y'/'Y' instead of 'z'/'Z': queued, but the host should slow down
+                    char ack = txqueue.nearlyFull(channel) ? 'y' : 'z';
                     if (line[0] < 'Z')
-                        USBTIN_serialPort->putc('Z');
-                    else
-                        USBTIN_serialPort->putc('z');
+                        ack -= 'a' - 'A';
+                    txbuffer.putc(ack);
                     result = CR;
                 }
 
@@ -319,6 +606,12 @@ void parseLine(char * line) {
                 unsigned char flags = 0; //mcp2515_read_register(MCP2515_REG_EFLG);
                 unsigned char status = 0;
 
+                if (rxFilled(channel) >= rxsize)
+                    status |= 0x01; // receive fifo full
+                if (txqueue.nearlyFull(channel))
+                    status |= 0x02; // transmit fifo full
+                if (rxTakeOverrun(channel))
+                    status |= 0x08; // data overrun since last read
                 if (flags & 0x01)
                     status |= 0x04; // error warning
                 if (flags & 0xC0)
@@ -328,186 +621,241 @@ void parseLine(char * line) {
                 if (flags & 0x20)
                     status |= 0x80; // bus error
 
-                USBTIN_serialPort->putc('F');
+                txbuffer.putc('F');
                 sendByteHex(status);
                 result = CR;
             }
             break;
+        case 'Q': // Read receive buffer statistics
+            {
+                txbuffer.putc('Q');
+                sendHex(rxstats[channel].dropped_full, 8);
+                sendHex(rxstats[channel].dropped_overrun, 8);
+                sendHex(rxstats[channel].highwater, 4);
+                sendHex(rxFilled(channel), 4);
+                sendHex(swfilter.rejected, 8);
+                sendHex(gateway.stats[channel].forwarded, 8);
+                sendHex(gateway.stats[channel].dropped, 8);
+                sendHex(change.suppressed[channel], 8);
+                sendHex(ratelimit.decimated[channel], 8);
+                sendHex(change.untracked[channel], 8);
+                result = CR;
+            }
+            break;
+#if USBTIN_PERF
+        case 'P': // Read instrumentation, restarts the stage timings
+            {
+                perf_stage_t stages[PERF_STAGES];
+                perf_counters_t counters;
+                unsigned char stage;
+
+                PORT_CAN_LOCK();
+                for (stage = 0; stage < PERF_STAGES; stage++)
+                    stages[stage] = *(perf_stage_t *) &perf.stages[stage];
+                counters = *(perf_counters_t *) &perf.counters[channel];
+                PORT_CAN_UNLOCK();
+                perf.clearStages();
+
+                txbuffer.putc('P');
+                for (stage = 0; stage < PERF_STAGES; stage++) {
+                    unsigned long count = stages[stage].count;
+                    sendHex(count, 8);
+                    sendHex(count ? stages[stage].min : 0, 8);
+                    sendHex(count ? (unsigned long) (stages[stage].sum / count) : 0, 8);
+                    sendHex(stages[stage].max, 8);
+                }
+                sendHex(counters.rx, 8);
+                sendHex(counters.host, 8);
+                sendHex(counters.tx, 8);
+                sendHex(counters.dropped_closed, 8);
+                sendHex(rxstats[channel].dropped_full, 8);
+                sendHex(rxstats[channel].dropped_overrun, 8);
+                sendHex(swfilter.rejected, 8);
+                sendHex(gateway.stats[channel].dropped, 8);
+                sendHex(counters.dropped_txfull, 8);
+                sendHex(rxstats[channel].highwater, 4);
+                sendHex(counters.tx_highwater, 4);
+                result = CR;
+            }
+            break;
+#endif
+        case 'U': // Set serial link baud rate, applies after the response
+            {
+                unsigned long code;
+                if (hex_decode(&line[1], 1, &code) && (code < sizeof(serialBauds) / sizeof(serialBauds[0]))) {
+                    serialBaud = serialBauds[code];
+                    result = CR;
+                }
+            }
+            break;
         case 'Z': // Set time stamping
             {
                 unsigned long stamping;
-                if (parseHex(&line[1], 1, &stamping)) {
-                    timestamping = (stamping != 0);
+                if (hex_decode(&line[1], 1, &stamping)
+                        && (stamping <= (timestamp.available ? TIMESTAMP_US : TIMESTAMP_OFF))) {
+                    timestamp.mode = stamping;
+                    result = CR;
+                }
+            }
+            break;
+        case 'B': // Switch to binary framing mode (see UT_binary.h)
+            {
+                unsigned long mode;
+                if (hex_decode(&line[1], 1, &mode)) {
+                    binary.mode = (mode != 0);
                     result = CR;
                 }
             }
             break;
         case 'm': // Set accpetance filter mask
-            if (deviceState == STATE_CONFIG) {
+            if (channelsClosed(*this)) {
                 unsigned long am0, am1, am2, am3;
-                if (parseHex(&line[1], 2, &am0) && parseHex(&line[3], 2, &am1)
-                        && parseHex(&line[5], 2, &am2)
-                        && parseHex(&line[7], 2, &am3)) {
-                    //mcp2515_set_SJA1000_filter_mask(am0, am1, am2, am3);
+                if (hex_decode(&line[1], 2, &am0) && hex_decode(&line[3], 2, &am1)
+                        && hex_decode(&line[5], 2, &am2)
+                        && hex_decode(&line[7], 2, &am3)) {
+                    canfilter.setMask((am0 << 24) | (am1 << 16) | (am2 << 8) | am3);
                     result = CR;
                 }
             }
             break;
         case 'M': // Set accpetance filter code
-            if (deviceState == STATE_CONFIG) {
+            if (channelsClosed(*this)) {
                 unsigned long ac0, ac1, ac2, ac3;
-                if (parseHex(&line[1], 2, &ac0) && parseHex(&line[3], 2, &ac1)
-                        && parseHex(&line[5], 2, &ac2)
-                        && parseHex(&line[7], 2, &ac3)) {
-                    //mcp2515_set_SJA1000_filter_code(ac0, ac1, ac2, ac3);
+                if (hex_decode(&line[1], 2, &ac0) && hex_decode(&line[3], 2, &ac1)
+                        && hex_decode(&line[5], 2, &ac2)
+                        && hex_decode(&line[7], 2, &ac3)) {
+                    canfilter.setCode((ac0 << 24) | (ac1 << 16) | (ac2 << 8) | ac3);
                     result = CR;
                 }
             }
             break;
+        case 'f': // Software filter: mode, add/remove standard or extended ids, clear
+            {
+                unsigned long mode, lo, hi;
+                unsigned char idlen = ((line[1] == 'e') || (line[1] == 'E')) ? 8 : 3;
+                unsigned char listed = (line[1] == 's') || (line[1] == 'e');
 
-    }
-
-    USBTIN_serialPort->putc(result);
-}
-
-/**
- * Get next character of given can message in ascii format
- * 
- * @param canmsg Pointer to can message
- * @param step Current step
- * @return Next character to print out
- */
-char canmsg2ascii_getNextChar(canmsg_t * canmsg, unsigned char * step) {
-
-    char ch = BELL;
-    char newstep = *step;
-
-    if (*step == RX_STEP_TYPE) {
-
-        // type
-
-        if (canmsg->flags.extended) {
-            newstep = RX_STEP_ID_EXT;
-            if (canmsg->flags.rtr)
-                ch = 'R';
-            else
-                ch = 'T';
-        } else {
-            newstep = RX_STEP_ID_STD;
-            if (canmsg->flags.rtr)
-                ch = 'r';
-            else
-                ch = 't';
-        }
-
-    } else if (*step < RX_STEP_DLC) {
-
-        // id
-
-        unsigned char i = *step - 1;
-        unsigned char * id_bp = (unsigned char*) &canmsg->id;
-        ch = id_bp[3 - (i / 2)];
-        if ((i % 2) == 0)
-            ch = ch >> 4;
-
-        ch = ch & 0xF;
-        if (ch > 9)
-            ch = ch - 10 + 'A';
-        else
-            ch = ch + '0';
-
-        newstep++;
-
-    } else if (*step < RX_STEP_DATA) {
-
-        // length
-
-        ch = canmsg->dlc;
-
-        ch = ch & 0xF;
-        if (ch > 9)
-            ch = ch - 10 + 'A';
-        else
-            ch = ch + '0';
-
-        if ((canmsg->dlc == 0) || canmsg->flags.rtr)
-            newstep = RX_STEP_TIMESTAMP;
-        else
-            newstep++;
-
-    } else if (*step < RX_STEP_TIMESTAMP) {
-
-        // data
-
-        unsigned char i = *step - RX_STEP_DATA;
-        ch = canmsg->data[i / 2];
-        if ((i % 2) == 0)
-            ch = ch >> 4;
-
-        ch = ch & 0xF;
-        if (ch > 9)
-            ch = ch - 10 + 'A';
-        else
-            ch = ch + '0';
-
-        newstep++;
-        if (newstep - RX_STEP_DATA == canmsg->dlc * 2)
-            newstep = RX_STEP_TIMESTAMP;
-
-    } else if (timestamping && (*step < RX_STEP_CR)) {
-
-        // timestamp
-
-        unsigned char i = *step - RX_STEP_TIMESTAMP;
-        if (i < 2)
-            ch = (canmsg->timestamp >> 8) & 0xff;
-        else
-            ch = canmsg->timestamp & 0xff;
-        if ((i % 2) == 0)
-            ch = ch >> 4;
-
-        ch = ch & 0xF;
-        if (ch > 9)
-            ch = ch - 10 + 'A';
-        else
-            ch = ch + '0';
-
-        newstep++;
-
-    } else {
+                switch (line[1]) {
+                    case 'm':
+                        if (hex_decode(&line[2], 1, &mode) && (mode <= SWFILTER_DENY)) {
+                            swfilter.setMode(mode);
+                            result = CR;
+                        }
+                        break;
+                    case 'c':
+                        swfilter.clear();
+                        result = CR;
+                        break;
+                    case 's':
+                    case 'S':
+                    case 'e':
+                    case 'E':
+                        if (!hex_decode(&line[2], idlen, &lo))
+                            break;
+                        hi = lo;
+                        if ((line[2 + idlen] != 0) && !hex_decode(&line[2 + idlen], idlen, &hi))
+                            break;
+                        if ((lo > hi) || (hi > ((idlen == 3) ? 0x7FFUL : 0x1FFFFFFFUL)))
+                            break;
+                        if (idlen == 3) {
+                            swfilter.setStd(lo, hi, listed);
+                            result = CR;
+                        } else if (swfilter.setExt(lo, hi, listed)) {
+                            result = CR;
+                        }
+                        break;
+                }
+            }
+            break;
+        case 'd': // Change-only forwarding: mode, keep-alive interval, per id interval, clear
+            {
+                unsigned long mode, id, ms;
+                unsigned char idlen = (line[1] == 'e') ? 8 : 3;
 
-        // linebreak
+                switch (line[1]) {
+                    case 'm':
+                        if (hex_decode(&line[2], 1, &mode) && (mode <= 1)) {
+                            change.setMode(mode);
+                            result = CR;
+                        }
+                        break;
+                    case 'k':
+                        if (hex_decode(&line[2], 4, &ms)) {
+                            change.setKeepalive(ms);
+                            result = CR;
+                        }
+                        break;
+                    case 'c':
+                        change.clear();
+                        result = CR;
+                        break;
+                    case 's':
+                    case 'e':
+                        if (!hex_decode(&line[2], idlen, &id) || !hex_decode(&line[2 + idlen], 4, &ms))
+                            break;
+                        if (id > ((idlen == 3) ? 0x7FFUL : 0x1FFFFFFFUL))
+                            break;
+                        if (change.setIdKeepalive(channel, id, idlen == 8, ms))
+                            result = CR;
+                        break;
+                }
+            }
+            break;
+        case 'i': // Bus statistics: mode, summary, top ids
+            if (parseBusstats(*this, channel, &line[1]))
+                result = CR;
+            break;
+        case 'x': // Open or close ISO-TP link, PDUs are sent with 'X' (see UT_core.cpp)
+            if (parseIsotp(*this, channel, &line[1]))
+                result = CR;
+            break;
+        case 'n': // Add receive rate limiting rule, clear all rules
+            if (parseRateLimit(*this, channel, &line[1]))
+                result = CR;
+            break;
+        case 'p': // Timed replay: append frame, start, mark end, clear, status
+            if (parseReplay(*this, channel, &line[1]))
+                result = CR;
+            break;
+        case 'k': // Scheduler: set budgets, status with command latency percentiles, clear
+            if (parseSched(*this, &line[1]))
+                result = CR;
+            break;
+        case 'c': // Register cyclic frame, remove it without frame, remove all without arguments
+            if (parseCyclic(*this, channel, &line[1]))
+                result = CR;
+            break;
+        case 'u': // Update payload of cyclic frame in place
+            if (parseCyclicUpdate(*this, &line[1]))
+                result = CR;
+            break;
+        case 'g': // Add gateway route, clear all routes without arguments
+            if (line[1] == 0) {
+                gateway.clear();
+                result = CR;
+            } else if (parseRoute(*this, &line[1])) {
+                result = CR;
+            }
+            break;
+        case 'a': // Add standard id or id range to acceptance list, clear lists without id
+        case 'A': // Add extended id or id range to acceptance list, clear lists without id
+            if (channelsClosed(*this)) {
+                unsigned char idlen = (line[0] == 'A') ? 8 : 3;
+                unsigned long lo, hi;
+                if (line[1] == 0) {
+                    canfilter.clearLists();
+                    result = CR;
+                } else if (hex_decode(&line[1], idlen, &lo)) {
+                    hi = lo;
+                    if ((line[1 + idlen] == 0) || hex_decode(&line[1 + idlen], idlen, &hi)) {
+                        if ((idlen == 3) ? canfilter.addStd(lo, hi) : canfilter.addExt(lo, hi))
+                            result = CR;
+                    }
+                }
+            }
+            break;
 
-        ch = CR;
-        newstep = RX_STEP_FINISHED;
     }
 
-    *step = newstep;
-    return ch;
-}
-
-CANMessage toCANMessage(canmsg_t *msg) {
-    CANMessage Cmsg;
-    Cmsg.format = msg->flags.extended ? CANExtended : CANStandard;
-    Cmsg.type = msg->flags.rtr ? CANRemote : CANData;
-    Cmsg.id = msg->id;
-    Cmsg.len = msg->dlc;
-    memcpy(Cmsg.data, msg->data, msg->dlc);
-    return Cmsg;
-}
-
-canmsg_t fromCANMessage(CANMessage *msg) {
-    canmsg_t cmsg;
-    cmsg.flags.extended = (msg->format == CANExtended);
-    cmsg.flags.rtr = (msg->type == CANRemote);
-    cmsg.id = msg->id;
-    cmsg.dlc = msg->len;
-    memcpy(cmsg.data, msg->data, msg->len);
-
-    // msg.id = (uint32_t)buffer->ident & 0x07FFU;
-    // msg.len = (uint32_t)buffer->ident >> 12U & 0xFU;
-    // msg.type = ((uint32_t)buffer->ident & 0x8000U) == 0x8000 ? CANRemote : CANData;
-    // memcpy(buffer->data, msg.data, msg.len)
-
-    return cmsg;
+    txbuffer.putc(result);
 }
@@ -20,29 +20,75 @@
 #ifndef _FRONTEND_
 #define _FRONTEND_
 
-#include "mbed.h"
-#include "CAN.h"
 #include "UT_CANMessage.h"
+#include "UT_hex.h"
+#include "UT_timestamp.h"
 
 #define LINE_MAXLEN 100
 #define BELL 7
 #define CR 13
 #define LR 10
 
-#define RX_STEP_TYPE 0
-#define RX_STEP_ID_EXT 1
-#define RX_STEP_ID_STD 6
-#define RX_STEP_DLC 9
-#define RX_STEP_DATA 10
-#define RX_STEP_TIMESTAMP 26
-#define RX_STEP_CR 30
-#define RX_STEP_FINISHED 0xff
-
-unsigned char transmitStd(char *line);
-void parseLine(char * line);
-char canmsg2ascii_getNextChar(canmsg_t * canmsg, unsigned char * step);
-
-CANMessage toCANMessage(canmsg_t *msg);
-canmsg_t fromCANMessage(CANMessage *msg);
+// channel + type + id + dlc + data + timestamp (us) + CR
+#define CANMSG_ASCII_MAXLEN (1 + 1 + 8 + 1 + 16 + 8 + 1)
+
+// the command parser is part of UT_Device (UT_core.h)
+unsigned char parseFrame(char * line, canmsg_t * canmsg);
+
+/**
+ * Convert given can message to a complete ascii line.
+ * Messages of channels other than 0 are prefixed with the channel digit.
+ *
+ * @param channel Channel the message was received on
+ * @param canmsg Pointer to can message
+ * @param buf Output buffer, at least CANMSG_ASCII_MAXLEN bytes
+ * @param stamping Timestamp format, TIMESTAMP_*
+ * @param timestamp Timestamp restored by UT_Timestamp::expand()
+ * @return Count of characters written
+ */
+static inline unsigned char canmsg2ascii(unsigned char channel, canmsg_t * canmsg, char * buf,
+        unsigned char stamping, unsigned long timestamp) {
+    char * p = buf;
+
+    if (channel != 0)
+        *p++ = '0' + channel;
+
+    // type and id
+    if (canmsg->extended) {
+        *p++ = canmsg->rtr ? 'R' : 'T';
+        hex_encode(p, canmsg->id, 8);
+        p += 8;
+    } else {
+        *p++ = canmsg->rtr ? 'r' : 't';
+        hex_encode(p, canmsg->id, 3);
+        p += 3;
+    }
+
+    // length
+    hex_encode(p++, canmsg->dlc, 1);
+
+    // data
+    if (!canmsg->rtr) {
+        unsigned char length = canmsg->dlc;
+        if (length > 8)
+            length = 8;
+        hex_encodeBytes(p, canmsg->data, length);
+        p += length * 2;
+    }
+
+    // timestamp
+    if (stamping == TIMESTAMP_MS) {
+        hex_encode(p, timestamp, 4);
+        p += 4;
+    } else if (stamping == TIMESTAMP_US) {
+        hex_encode(p, timestamp, 8);
+        p += 8;
+    }
+
+    // linebreak
+    *p++ = CR;
+
+    return p - buf;
+}
 
 #endif
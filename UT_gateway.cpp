@@ -0,0 +1,93 @@
+/********************************************************************
+ File: UT_gateway.cpp
+
+ Description:
+ This file contains the on-device gateway functions.
+ Routes are checked in the order they were added, the first match
+ wins. The table is changed from the thread with the CAN interrupt
+ masked.
+
+ ********************************************************************/
+
+#include "UT_gateway.h"
+
+#include <string.h>
+
+#include "UT_core.h"
+
+UT_Gateway::UT_Gateway(UT_Device & dev) : dev(dev) {
+    count = 0;
+    memset((void *) stats, 0, sizeof(stats));
+}
+
+/**
+ * Append route to the routing table
+ *
+ * @param route Route to add
+ * @return 1 on success, 0 on invalid channel, a route back to its own
+ *         channel or full table
+ */
+unsigned char UT_Gateway::add(gateway_route_t * route) {
+    if ((route->src >= USBTIN_CHANNELS) || (route->dst >= USBTIN_CHANNELS))
+        return 0;
+    if (route->src == route->dst)
+        return 0;
+    if (count >= GATEWAY_MAXROUTES)
+        return 0;
+
+    PORT_CAN_LOCK();
+    routes[count] = *route;
+    count++;
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Remove all routes and reset statistics
+ */
+void UT_Gateway::clear(void) {
+    unsigned char channel;
+
+    PORT_CAN_LOCK();
+    count = 0;
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        stats[channel].forwarded = 0;
+        stats[channel].dropped = 0;
+    }
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Apply routing table to given received frame (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param msg Received frame
+ * @return 1 if the frame is to be delivered to the host
+ */
+unsigned char UT_Gateway::forward(unsigned char channel, canmsg_t * msg) {
+    unsigned char extended = msg->extended;
+    unsigned char n = count;
+    unsigned char i;
+
+    for (i = 0; i < n; i++) {
+        gateway_route_t * route = &routes[i];
+
+        if ((route->src != channel) || (((route->flags & GATEWAY_EXTENDED) != 0) != extended))
+            continue;
+        if ((msg->id ^ route->id) & route->mask)
+            continue;
+
+        canmsg_t canmsg = *msg;
+        canmsg.id = ((msg->id & ~route->rwmask) | (route->rwid & route->rwmask))
+            & (extended ? 0x1FFFFFFF : 0x7FF);
+
+        if ((dev.state[route->dst] == STATE_OPEN) && dev.txqueue.putFromIsr(route->dst, &canmsg))
+            stats[channel].forwarded++;
+        else
+            stats[channel].dropped++;
+
+        return (route->flags & GATEWAY_TOHOST) != 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,62 @@
+/********************************************************************
+ File: UT_gateway.h
+
+ Description:
+ This file contains the on-device gateway definitions. Received
+ frames matching a route are queued for transmission on the route's
+ destination channel directly from the receive interrupt, optionally
+ with a rewritten identifier.
+
+ ********************************************************************/
+#ifndef _GATEWAY_
+#define _GATEWAY_
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+#ifndef GATEWAY_MAXROUTES
+#define GATEWAY_MAXROUTES 32
+#endif
+
+#define GATEWAY_EXTENDED 0x01   // route matches extended frames, else standard
+#define GATEWAY_TOHOST 0x02     // also deliver routed frames to the host
+
+typedef struct
+{
+    unsigned char src;          // source channel
+    unsigned char dst;          // destination channel
+    unsigned char flags;        // GATEWAY_* flags
+    unsigned long id;           // match: (frame id & mask) == (id & mask)
+    unsigned long mask;
+    unsigned long rwid;         // rewrite: id = (id & ~rwmask) | (rwid & rwmask)
+    unsigned long rwmask;
+} gateway_route_t;
+
+// gateway statistics per source channel, written by the receive interrupt
+typedef struct
+{
+    unsigned long forwarded;    // frames queued on the destination channel
+    unsigned long dropped;      // destination closed or transmit queue full
+} gateway_stats_t;
+
+class UT_Device;
+
+class UT_Gateway {
+public:
+    UT_Gateway(UT_Device & dev);
+
+    unsigned char add(gateway_route_t * route);
+    void clear(void);
+
+    unsigned char forward(unsigned char channel, canmsg_t * msg);
+
+    volatile gateway_stats_t stats[USBTIN_CHANNELS];
+
+private:
+    UT_Device & dev;
+
+    gateway_route_t routes[GATEWAY_MAXROUTES];
+    volatile unsigned char count;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/********************************************************************
+ File: UT_hex.cpp
+
+ Description:
+ This file contains the hexadecimal codec functions.
+
+ The tables store the character pairs in memory order of a little
+ endian target (Cortex-M3), so a pair can be copied with one
+ halfword access.
+
+ ********************************************************************/
+
+#include "UT_hex.h"
+
+#define HEX_CHAR(n) ((n) < 10 ? '0' + (n) : 'A' - 10 + (n))
+#define HEX_PAIR(b) ((unsigned short) (HEX_CHAR((b) >> 4) | (HEX_CHAR((b) & 0xF) << 8)))
+#define HEX_PAIR4(b) HEX_PAIR(b), HEX_PAIR((b) + 1), HEX_PAIR((b) + 2), HEX_PAIR((b) + 3)
+#define HEX_PAIR16(b) HEX_PAIR4(b), HEX_PAIR4((b) + 4), HEX_PAIR4((b) + 8), HEX_PAIR4((b) + 12)
+#define HEX_PAIR64(b) HEX_PAIR16(b), HEX_PAIR16((b) + 16), HEX_PAIR16((b) + 32), HEX_PAIR16((b) + 48)
+
+const unsigned short hex_encode_table[256] = {
+    HEX_PAIR64(0), HEX_PAIR64(64), HEX_PAIR64(128), HEX_PAIR64(192)
+};
+
+#define HEX_VALUE(c) ( \
+        ((c) >= '0' && (c) <= '9') ? (c) - '0' : \
+        ((c) >= 'A' && (c) <= 'F') ? (c) - 'A' + 10 : \
+        ((c) >= 'a' && (c) <= 'f') ? (c) - 'a' + 10 : HEX_INVALID)
+#define HEX_VALUE4(c) HEX_VALUE(c), HEX_VALUE((c) + 1), HEX_VALUE((c) + 2), HEX_VALUE((c) + 3)
+#define HEX_VALUE16(c) HEX_VALUE4(c), HEX_VALUE4((c) + 4), HEX_VALUE4((c) + 8), HEX_VALUE4((c) + 12)
+#define HEX_VALUE64(c) HEX_VALUE16(c), HEX_VALUE16((c) + 16), HEX_VALUE16((c) + 32), HEX_VALUE16((c) + 48)
+
+const unsigned char hex_decode_table[256] = {
+    HEX_VALUE64(0), HEX_VALUE64(64), HEX_VALUE64(128), HEX_VALUE64(192)
+};
+
+#define HIGHS ((uint32_t) 0x80808080)
+
+/**
+ * Parse hex value of given string
+ *
+ * @param buf Input string
+ * @param len Count of characters to interpret
+ * @param value Pointer to variable for the resulting decoded value
+ * @return 0 on error, 1 on success
+ */
+unsigned char hex_decode(const char * buf, unsigned char len, unsigned long * value) {
+    unsigned long v = 0;
+    while (len--) {
+        unsigned char nibble = hex_decode_table[(unsigned char) *buf++];
+        // also stops at the string terminator
+        if (nibble == HEX_INVALID)
+            return 0;
+        v = (v << 4) | nibble;
+    }
+    *value = v;
+    return 1;
+}
+
+/**
+ * Parse hex string to bytes.
+ * Four characters are checked and converted per word. A group is
+ * only loaded after checking it holds no string terminator, so the
+ * input is never read past the end of a short string.
+ *
+ * @param buf Input string, 2 * len characters
+ * @param data Output bytes
+ * @param len Count of bytes to decode
+ * @return 0 on error, 1 on success
+ */
+unsigned char hex_decodeBytes(const char * buf, unsigned char * data, unsigned char len) {
+    while (len >= 2) {
+        uint32_t c;
+        if (!buf[0] || !buf[1] || !buf[2] || !buf[3])
+            return 0;
+        memcpy(&c, buf, 4);
+
+        // per byte range checks, valid only for 7-bit characters
+        uint32_t lower = c | (0x20 * HEX_ONES);
+        uint32_t digit = (c + (0x80 - '0') * HEX_ONES) & ~(c + (0x7F - '9') * HEX_ONES);
+        uint32_t alpha = (lower + (0x80 - 'a') * HEX_ONES) & ~(lower + (0x7F - 'f') * HEX_ONES);
+        if ((c & HIGHS) || ((digit | alpha) & HIGHS) != HIGHS)
+            return 0;
+
+        // letters have bit 6 set: low nibble + 9 gives their value
+        uint32_t n = (c & 0x0F * HEX_ONES) + ((c >> 6) & HEX_ONES) * 9;
+        uint32_t t = ((n << 4) | (n >> 8)) & 0x00FF00FF;
+        data[0] = t;
+        data[1] = t >> 16;
+
+        buf += 4;
+        data += 2;
+        len -= 2;
+    }
+    if (len) {
+        unsigned long value;
+        if (!hex_decode(buf, 2, &value))
+            return 0;
+        data[0] = value;
+    }
+    return 1;
+}
@@ -0,0 +1,83 @@
+/********************************************************************
+ File: UT_hex.h
+
+ Description:
+ This file contains the hexadecimal codec definitions.
+ Encoding uses a byte to two character lookup table, decoding a
+ character to nibble table. Payload conversion works on 32-bit words.
+ The encoders are inline, so canmsg2ascii() pays no call per field
+ and the id conversions of constant length unroll.
+
+ ********************************************************************/
+#ifndef _HEX_
+#define _HEX_
+
+#include <stdint.h>
+#include <string.h>
+
+#define HEX_INVALID 0xFF
+#define HEX_ONES ((uint32_t) 0x01010101)
+
+// two ascii characters per byte value, first character in the low byte
+extern const unsigned short hex_encode_table[256];
+// nibble value per character, HEX_INVALID for non hex characters
+extern const unsigned char hex_decode_table[256];
+
+/**
+ * Write given byte as two hex characters
+ *
+ * @param buf Output buffer
+ * @param value Byte to convert
+ */
+static inline void hex_encodeByte(char * buf, unsigned char value) {
+    memcpy(buf, &hex_encode_table[value], 2);
+}
+
+/**
+ * Write given value as hexadecimal string to buffer
+ *
+ * @param buf Output buffer
+ * @param value Value to convert
+ * @param len Count of characters to produce
+ */
+static inline void hex_encode(char * buf, unsigned long value, unsigned char len) {
+    while (len >= 2) {
+        len -= 2;
+        hex_encodeByte(&buf[len], value & 0xFF);
+        value >>= 8;
+    }
+    if (len)
+        buf[0] = hex_encode_table[value & 0xF] >> 8;
+}
+
+/**
+ * Write given bytes as hexadecimal string to buffer.
+ * Two bytes are spread to four nibbles in one word and converted to
+ * ascii without branches: '0' is added to each nibble, plus 7 for
+ * nibbles above 9.
+ *
+ * @param buf Output buffer, 2 * len characters
+ * @param data Bytes to convert
+ * @param len Count of bytes
+ */
+static inline void hex_encodeBytes(char * buf, const unsigned char * data, unsigned char len) {
+    while (len >= 2) {
+        uint32_t hi = (data[0] >> 4) | ((uint32_t) (data[1] >> 4) << 16);
+        uint32_t lo = (data[0] & 0xF) | ((uint32_t) (data[1] & 0xF) << 16);
+        uint32_t w = hi | (lo << 8);
+        uint32_t above9 = ((w + 6 * HEX_ONES) >> 4) & HEX_ONES;
+        w += '0' * HEX_ONES + 7 * above9;
+        memcpy(buf, &w, 4);
+
+        buf += 4;
+        data += 2;
+        len -= 2;
+    }
+    if (len)
+        hex_encodeByte(buf, data[0]);
+}
+
+unsigned char hex_decode(const char * buf, unsigned char len, unsigned long * value);
+unsigned char hex_decodeBytes(const char * buf, unsigned char * data, unsigned char len);
+
+#endif
@@ -0,0 +1,62 @@
+/********************************************************************
+ File: UT_idhash.h
+
+ Description:
+ This file contains the id hash table helpers shared by the per id
+ tables (change-only forwarding, rate limiting, bus statistics).
+ Entries are keyed by channel, frame format and identifier and found
+ by linear probing from a multiplicative hash. Each entry type must
+ start with its uint32_t key, 0 marking a free slot. Entries are
+ never removed one by one, so probing stops at the first free slot.
+ Table sizes must satisfy IDHASH_SIZE_VALID.
+
+ ********************************************************************/
+#ifndef _IDHASH_
+#define _IDHASH_
+
+#include <stdint.h>
+
+#define IDHASH_KEY_EXTENDED 0x20000000UL
+#define IDHASH_KEY_CHANNEL 0x40000000UL
+#define IDHASH_KEY_USED 0x80000000UL
+
+// power of two not greater than 32768, for use in #if
+#define IDHASH_SIZE_VALID(size) ((((size) & ((size) - 1)) == 0) && ((size) <= 32768))
+
+/**
+ * Build table key
+ *
+ * @param channel Channel index
+ * @param id Identifier
+ * @param extended 1 for extended identifier
+ * @return Key, never 0
+ */
+static inline uint32_t idhash_key(unsigned char channel, unsigned long id, unsigned char extended) {
+    return IDHASH_KEY_USED | (channel ? IDHASH_KEY_CHANNEL : 0)
+        | (extended ? IDHASH_KEY_EXTENDED : 0) | (id & 0x1FFFFFFF);
+}
+
+/**
+ * Find slot of given key or the free slot to insert it into
+ *
+ * @param table First entry
+ * @param stride Entry size in bytes
+ * @param size Count of entries
+ * @param key Table key
+ * @return Slot index, size if the key is missing and the table is full
+ */
+static inline unsigned short idhash_find(const volatile void * table, unsigned short stride,
+        unsigned short size, uint32_t key) {
+    unsigned short pos = (uint32_t) (key * 2654435761UL) >> 16;
+    unsigned short probes;
+
+    for (probes = 0; probes < size; probes++) {
+        unsigned short slot = (pos + probes) & (size - 1);
+        uint32_t found = *(const volatile uint32_t *) ((const volatile char *) table + slot * stride);
+        if ((found == key) || (found == 0))
+            return slot;
+    }
+    return size;
+}
+
+#endif
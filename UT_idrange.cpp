@@ -0,0 +1,124 @@
+/********************************************************************
+ File: UT_idrange.cpp
+
+ Description:
+ This file contains the id range list functions.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_idrange.h"
+
+/**
+ * Insert id range into sorted list, merging overlapping and adjacent ranges
+ *
+ * @param list Range list
+ * @param count Pointer to count of ranges in list
+ * @param max Capacity of list
+ * @param lo First id of range
+ * @param hi Last id of range
+ * @return 1 on success, 0 if the list is full
+ */
+unsigned char idrange_add(idrange_t * list, unsigned short * count, unsigned short max,
+        unsigned long lo, unsigned long hi) {
+    unsigned short n = *count;
+    unsigned short i = 0;
+    unsigned short j;
+
+    while ((i < n) && (list[i].hi + 1 < lo))
+        i++;
+
+    for (j = i; (j < n) && (list[j].lo <= hi + 1); j++) {
+        if (list[j].lo < lo)
+            lo = list[j].lo;
+        if (list[j].hi > hi)
+            hi = list[j].hi;
+    }
+
+    if (i == j) {
+        if (n >= max)
+            return 0;
+        memmove(&list[i + 1], &list[i], (n - i) * sizeof(idrange_t));
+        n++;
+    } else {
+        memmove(&list[i + 1], &list[j], (n - j) * sizeof(idrange_t));
+        n -= j - i - 1;
+    }
+
+    list[i].lo = lo;
+    list[i].hi = hi;
+    *count = n;
+    return 1;
+}
+
+/**
+ * Remove id range from sorted list, splitting ranges that contain it
+ *
+ * @param list Range list
+ * @param count Pointer to count of ranges in list
+ * @param max Capacity of list
+ * @param lo First id to remove
+ * @param hi Last id to remove
+ * @return 1 on success, 0 if a split doesn't fit into the list
+ */
+unsigned char idrange_remove(idrange_t * list, unsigned short * count, unsigned short max,
+        unsigned long lo, unsigned long hi) {
+    unsigned short n = *count;
+    unsigned short i = 0;
+    unsigned short j;
+
+    while ((i < n) && (list[i].hi < lo))
+        i++;
+
+    // range strictly inside one entry: split it
+    if ((i < n) && (list[i].lo < lo) && (list[i].hi > hi)) {
+        if (n >= max)
+            return 0;
+        memmove(&list[i + 1], &list[i], (n - i) * sizeof(idrange_t));
+        list[i].hi = lo - 1;
+        list[i + 1].lo = hi + 1;
+        *count = n + 1;
+        return 1;
+    }
+
+    // cut the head of an entry overlapping from below
+    if ((i < n) && (list[i].lo < lo)) {
+        list[i].hi = lo - 1;
+        i++;
+    }
+
+    // drop entries covered completely
+    for (j = i; (j < n) && (list[j].hi <= hi); j++)
+        ;
+
+    // cut the tail of an entry overlapping from above
+    if ((j < n) && (list[j].lo <= hi))
+        list[j].lo = hi + 1;
+
+    memmove(&list[i], &list[j], (n - j) * sizeof(idrange_t));
+    *count = n - (j - i);
+    return 1;
+}
+
+/**
+ * Check if given id is in one of the ranges (binary search)
+ *
+ * @param list Range list
+ * @param count Count of ranges in list
+ * @param id Id to look up
+ * @return 1 if found, 0 otherwise
+ */
+unsigned char idrange_contains(const idrange_t * list, unsigned short count, unsigned long id) {
+    unsigned short lo = 0;
+    unsigned short hi = count;
+
+    while (lo < hi) {
+        unsigned short mid = (lo + hi) >> 1;
+        if (list[mid].hi < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < count) && (list[lo].lo <= id);
+}
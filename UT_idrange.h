@@ -0,0 +1,25 @@
+/********************************************************************
+ File: UT_idrange.h
+
+ Description:
+ This file contains the id range list definitions. Lists are kept
+ sorted with overlapping and adjacent ranges merged, so lookups can
+ use binary search.
+
+ ********************************************************************/
+#ifndef _IDRANGE_
+#define _IDRANGE_
+
+typedef struct
+{
+    unsigned long lo;   // first id
+    unsigned long hi;   // last id
+} idrange_t;
+
+unsigned char idrange_add(idrange_t * list, unsigned short * count, unsigned short max,
+        unsigned long lo, unsigned long hi);
+unsigned char idrange_remove(idrange_t * list, unsigned short * count, unsigned short max,
+        unsigned long lo, unsigned long hi);
+unsigned char idrange_contains(const idrange_t * list, unsigned short count, unsigned long id);
+
+#endif
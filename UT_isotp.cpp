@@ -0,0 +1,540 @@
+/********************************************************************
+ File: UT_isotp.cpp
+
+ Description:
+ This file contains the ISO-TP offload functions.
+ Receive and flow control handling runs in the CAN receive interrupt,
+ consecutive frame pacing and timeouts in the engine tick, which has
+ the same priority. The thread fills the transmit buffer of an idle
+ link, starts transmissions and reports results with the CAN
+ interrupt masked.
+
+ Consecutive frames are queued at tick times, STmin is rounded up to
+ whole ticks. With STmin 0 frames are queued back to back as long as
+ half of the transmit queue is free.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_isotp.h"
+
+#include "UT_core.h"
+#include "UT_hex.h"
+
+#if (ISOTP_MAXPDU > 4095) || (ISOTP_MAXPDU < 7) || (ISOTP_MAXLINKS > 10)
+#error "ISOTP_MAXPDU must be 7..4095 and ISOTP_MAXLINKS at most 10"
+#endif
+
+#if (ISOTP_MAXLINKS * ISOTP_MAXPDU > 16384)
+#error "ISO-TP buffers of one direction must fit into a 16 KB RAM bank"
+#endif
+
+#define ISOTP_TIMEOUT_TICKS (ISOTP_TIMEOUT * 1000UL / CYCLIC_TICK_US)
+#define ISOTP_PADBYTE 0xCC
+
+#define PCI_SINGLE 0x0
+#define PCI_FIRST 0x1
+#define PCI_CONSECUTIVE 0x2
+#define PCI_FLOWCONTROL 0x3
+
+#define FC_CTS 0x0
+#define FC_WAIT 0x1
+#define FC_OVERFLOW 0x2
+
+#define TX_IDLE 0
+#define TX_WAIT_FC 1
+#define TX_SENDING 2
+
+#define RX_IDLE 0
+#define RX_RECEIVING 1
+#define RX_READY 2
+
+
+UT_Isotp::UT_Isotp(UT_Device & dev, unsigned char (*txbufs)[ISOTP_MAXPDU],
+        unsigned char (*rxbufs)[ISOTP_MAXPDU]) : dev(dev) {
+    unsigned char link;
+
+    for (link = 0; link < ISOTP_MAXLINKS; link++) {
+        links[link].txbuf = txbufs[link];
+        links[link].rxbuf = rxbufs[link];
+        links[link].open = 0;
+        links[link].tx_state = TX_IDLE;
+        links[link].tx_status = ISOTP_NONE;
+        links[link].rx_state = RX_IDLE;
+        links[link].rx_status = ISOTP_NONE;
+    }
+    put_link = ISOTP_NONE;
+    put_high = 0;
+    put_half = 0;
+    put_error = 0;
+}
+
+/**
+ * Queue frame of given link for transmission (CAN interrupt context)
+ *
+ * @param link Link
+ * @param data Frame data including protocol control information
+ * @param len Count of data bytes
+ * @return 1 if queued, 0 if the transmit queue is full
+ */
+unsigned char UT_Isotp::sendFrame(isotp_link_t * link, const unsigned char * data, unsigned char len) {
+    canmsg_t canmsg;
+
+    canmsg.id = link->txid;
+    canmsg.extended = (link->flags & ISOTP_EXTENDED) != 0;
+    canmsg.rtr = 0;
+    memcpy(canmsg.data, data, len);
+    if (link->flags & ISOTP_PADDING) {
+        memset(&canmsg.data[len], ISOTP_PADBYTE, 8 - len);
+        len = 8;
+    }
+    canmsg.dlc = len;
+    return dev.txqueue.putFromIsr(link->channel, &canmsg);
+}
+
+/**
+ * Send flow control frame of given link
+ *
+ * @param link Link
+ * @param fs Flow status
+ */
+void UT_Isotp::sendFlowControl(isotp_link_t * link, unsigned char fs) {
+    unsigned char data[3];
+
+    data[0] = (PCI_FLOWCONTROL << 4) | fs;
+    data[1] = link->bs;
+    data[2] = link->stmin;
+    sendFrame(link, data, 3);
+}
+
+/**
+ * Finish transmission of given link
+ *
+ * @param link Link
+ * @param status ISOTP_STATUS_* to report
+ */
+void UT_Isotp::txDone(isotp_link_t * link, unsigned char status) {
+    link->tx_state = TX_IDLE;
+    link->tx_status = status;
+    dev.signal(UT_SIGNAL_CANRX);
+}
+
+/**
+ * Finish reception of given link with an error
+ *
+ * @param link Link
+ * @param status ISOTP_STATUS_* to report
+ */
+void UT_Isotp::rxFailed(isotp_link_t * link, unsigned char status) {
+    link->rx_state = RX_IDLE;
+    link->rx_status = status;
+    dev.signal(UT_SIGNAL_CANRX);
+}
+
+/**
+ * Convert STmin to ticks
+ *
+ * @param stmin STmin of a flow control frame
+ * @return Ticks between consecutive frames
+ */
+static unsigned short stminTicks(unsigned char stmin) {
+    unsigned long us;
+
+    if (stmin <= 0x7F)
+        us = stmin * 1000UL;
+    else if ((stmin >= 0xF1) && (stmin <= 0xF9))
+        us = (stmin - 0xF0) * 100UL;
+    else
+        us = 0x7F * 1000UL;     // reserved values: use the longest time
+    return (us + CYCLIC_TICK_US - 1) / CYCLIC_TICK_US;
+}
+
+/**
+ * Queue consecutive frames of given link as far as pacing, block size
+ * and transmit queue allow
+ *
+ * @param link Link in state TX_SENDING
+ */
+void UT_Isotp::sendConsecutive(isotp_link_t * link) {
+    unsigned char data[8];
+
+    do {
+        if (dev.txqueue.free(link->channel) <= TXQUEUE_SIZE / 2)
+            return;
+
+        unsigned short n = link->tx_len - link->tx_pos;
+        if (n > 7)
+            n = 7;
+        data[0] = (PCI_CONSECUTIVE << 4) | link->tx_sn;
+        memcpy(&data[1], &link->txbuf[link->tx_pos], n);
+        if (!sendFrame(link, data, n + 1))
+            return;
+
+        link->tx_pos += n;
+        link->tx_sn = (link->tx_sn + 1) & 0x0F;
+        if (link->tx_pos >= link->tx_len) {
+            txDone(link, ISOTP_STATUS_DONE);
+            return;
+        }
+        if (link->tx_bs && (--link->tx_blockleft == 0)) {
+            link->tx_state = TX_WAIT_FC;
+            link->tx_wait = ISOTP_TIMEOUT_TICKS;
+            return;
+        }
+    } while (link->tx_gap == 0);
+
+    link->tx_wait = link->tx_gap;
+}
+
+/**
+ * Handle flow control frame for the transmission of given link
+ *
+ * @param link Link
+ * @param canmsg Received frame
+ */
+void UT_Isotp::receiveFlowControl(isotp_link_t * link, canmsg_t * canmsg) {
+    if ((link->tx_state != TX_WAIT_FC) || (canmsg->dlc < 3))
+        return;
+
+    switch (canmsg->data[0] & 0x0F) {
+        case FC_CTS:
+            link->tx_bs = canmsg->data[1];
+            link->tx_blockleft = canmsg->data[1];
+            link->tx_gap = stminTicks(canmsg->data[2]);
+            link->tx_state = TX_SENDING;
+            link->tx_wait = 0;
+            sendConsecutive(link);
+            break;
+        case FC_WAIT:
+            link->tx_wait = ISOTP_TIMEOUT_TICKS;
+            break;
+        case FC_OVERFLOW:
+            txDone(link, ISOTP_STATUS_OVERFLOW);
+            break;
+        default:
+            txDone(link, ISOTP_STATUS_FAILED);
+            break;
+    }
+}
+
+/**
+ * Handle single, first and consecutive frames for given link
+ *
+ * @param link Link
+ * @param canmsg Received frame
+ */
+void UT_Isotp::receiveData(isotp_link_t * link, canmsg_t * canmsg) {
+    unsigned char * data = canmsg->data;
+    unsigned char dlc = (canmsg->dlc > 8) ? 8 : canmsg->dlc;
+    unsigned short len;
+
+    switch (data[0] >> 4) {
+        case PCI_SINGLE:
+            len = data[0] & 0x0F;
+            if ((len == 0) || (len > dlc - 1))
+                return;
+            if (link->rx_state == RX_READY) {
+                link->rx_status = ISOTP_STATUS_LOST;
+                dev.signal(UT_SIGNAL_CANRX);
+                return;
+            }
+            memcpy(link->rxbuf, &data[1], len);
+            link->rx_len = len;
+            link->rx_state = RX_READY;
+            dev.signal(UT_SIGNAL_CANRX);
+            break;
+
+        case PCI_FIRST:
+            len = ((data[0] & 0x0F) << 8) | data[1];
+            if ((dlc < 8) || (len < 8))
+                return;
+            if ((len > ISOTP_MAXPDU) || (link->rx_state == RX_READY)) {
+                sendFlowControl(link, FC_OVERFLOW);
+                return;
+            }
+            memcpy(link->rxbuf, &data[2], 6);
+            link->rx_len = len;
+            link->rx_pos = 6;
+            link->rx_sn = 1;
+            link->rx_blockleft = link->bs;
+            link->rx_timer = ISOTP_TIMEOUT_TICKS;
+            link->rx_state = RX_RECEIVING;
+            sendFlowControl(link, FC_CTS);
+            // wake the thread, so the port starts the tick for the timeout
+            dev.signal(UT_SIGNAL_CANRX);
+            break;
+
+        case PCI_CONSECUTIVE:
+            if (link->rx_state != RX_RECEIVING)
+                return;
+            if ((data[0] & 0x0F) != link->rx_sn) {
+                rxFailed(link, ISOTP_STATUS_SEQUENCE);
+                return;
+            }
+            len = link->rx_len - link->rx_pos;
+            if (len > dlc - 1)
+                len = dlc - 1;
+            memcpy(&link->rxbuf[link->rx_pos], &data[1], len);
+            link->rx_pos += len;
+            link->rx_sn = (link->rx_sn + 1) & 0x0F;
+            link->rx_timer = ISOTP_TIMEOUT_TICKS;
+
+            if (link->rx_pos >= link->rx_len) {
+                link->rx_state = RX_READY;
+                dev.signal(UT_SIGNAL_CANRX);
+            } else if (link->bs && (--link->rx_blockleft == 0)) {
+                link->rx_blockleft = link->bs;
+                sendFlowControl(link, FC_CTS);
+            }
+            break;
+    }
+}
+
+/**
+ * Set up given link, an open link is reset
+ *
+ * @param link Link index
+ * @param channel Channel index
+ * @param flags ISOTP_* flags
+ * @param txid Identifier of transmitted frames
+ * @param rxid Identifier of received frames
+ * @param bs Block size requested from the peer, 0 = no limit
+ * @param stmin STmin requested from the peer
+ * @return 1 on success, 0 on invalid arguments
+ */
+unsigned char UT_Isotp::open(unsigned char link, unsigned char channel, unsigned char flags,
+        unsigned long txid, unsigned long rxid, unsigned char bs, unsigned char stmin) {
+    unsigned long idmask = (flags & ISOTP_EXTENDED) ? 0x1FFFFFFFUL : 0x7FFUL;
+
+    if ((link >= ISOTP_MAXLINKS) || (channel >= USBTIN_CHANNELS))
+        return 0;
+    if ((txid > idmask) || (rxid > idmask))
+        return 0;
+
+    PORT_CAN_LOCK();
+    isotp_link_t * l = &links[link];
+    l->channel = channel;
+    l->flags = flags;
+    l->txid = txid;
+    l->rxid = rxid;
+    l->bs = bs;
+    l->stmin = stmin;
+    l->tx_state = TX_IDLE;
+    l->tx_status = ISOTP_NONE;
+    l->rx_state = RX_IDLE;
+    l->rx_status = ISOTP_NONE;
+    l->open = 1;
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Close given link, transfers in progress are aborted
+ *
+ * @param link Link index
+ * @return 1 on success, 0 on invalid link
+ */
+unsigned char UT_Isotp::close(unsigned char link) {
+    if (link >= ISOTP_MAXLINKS)
+        return 0;
+
+    PORT_CAN_LOCK();
+    links[link].open = 0;
+    links[link].tx_state = TX_IDLE;
+    links[link].rx_state = RX_IDLE;
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Start collecting a PDU from the host for given link
+ *
+ * @param link Link index
+ * @return 1 if the link is open and idle
+ */
+unsigned char UT_Isotp::begin(unsigned char link) {
+    if ((link >= ISOTP_MAXLINKS) || !links[link].open || (links[link].tx_state != TX_IDLE))
+        return 0;
+
+    put_link = link;
+    put_half = 0;
+    put_error = 0;
+    links[link].tx_len = 0;
+    return 1;
+}
+
+/**
+ * Append hex digit of the PDU the host is sending
+ *
+ * @param ch Hex digit
+ */
+void UT_Isotp::putHex(char ch) {
+    char digit[1] = { ch };
+    unsigned long value;
+    isotp_link_t * link = &links[put_link];
+
+    if (!hex_decode(digit, 1, &value) || (link->tx_len >= ISOTP_MAXPDU)) {
+        put_error = 1;
+        return;
+    }
+    if (!put_half) {
+        put_high = value << 4;
+        put_half = 1;
+    } else {
+        link->txbuf[link->tx_len++] = put_high | value;
+        put_half = 0;
+    }
+}
+
+/**
+ * Complete the PDU the host is sending and start its transmission
+ *
+ * @return 1 if the transmission was started
+ */
+unsigned char UT_Isotp::end(void) {
+    isotp_link_t * link = &links[put_link];
+    unsigned char data[8];
+    unsigned char ok = 0;
+
+    put_link = ISOTP_NONE;
+    if (put_error || put_half || (link->tx_len == 0) || (dev.state[link->channel] != STATE_OPEN))
+        return 0;
+
+    PORT_CAN_LOCK();
+    if (link->tx_len <= 7) {
+        data[0] = (PCI_SINGLE << 4) | link->tx_len;
+        memcpy(&data[1], link->txbuf, link->tx_len);
+        if (sendFrame(link, data, link->tx_len + 1)) {
+            link->tx_status = ISOTP_STATUS_DONE;
+            ok = 1;
+        }
+    } else {
+        data[0] = (PCI_FIRST << 4) | (link->tx_len >> 8);
+        data[1] = link->tx_len;
+        memcpy(&data[2], link->txbuf, 6);
+        if (sendFrame(link, data, 8)) {
+            link->tx_pos = 6;
+            link->tx_sn = 1;
+            link->tx_wait = ISOTP_TIMEOUT_TICKS;
+            link->tx_state = TX_WAIT_FC;
+            ok = 1;
+        }
+    }
+    PORT_CAN_UNLOCK();
+    return ok;
+}
+
+/**
+ * Take frames addressed to a link (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @return 1 if the frame belongs to a link, 0 to process it normally
+ */
+unsigned char UT_Isotp::receive(unsigned char channel, canmsg_t * canmsg) {
+    unsigned char i;
+
+    for (i = 0; i < ISOTP_MAXLINKS; i++) {
+        isotp_link_t * link = &links[i];
+        if (!link->open || (link->channel != channel) || (link->rxid != canmsg->id)
+                || (((link->flags & ISOTP_EXTENDED) != 0) != canmsg->extended))
+            continue;
+
+        if (canmsg->rtr || (canmsg->dlc == 0))
+            return 1;
+        if ((canmsg->data[0] >> 4) == PCI_FLOWCONTROL)
+            receiveFlowControl(link, canmsg);
+        else
+            receiveData(link, canmsg);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Check for transfers in progress. Ports may stop ticking without them.
+ *
+ * @return 1 if a link needs the tick
+ */
+unsigned char UT_Isotp::active(void) {
+    unsigned char i;
+
+    for (i = 0; i < ISOTP_MAXLINKS; i++)
+        if ((links[i].tx_state != TX_IDLE) || (links[i].rx_state == RX_RECEIVING))
+            return 1;
+    return 0;
+}
+
+/**
+ * Pace consecutive frames and check timeouts (engine tick)
+ */
+void UT_Isotp::tick(void) {
+    unsigned char i;
+
+    for (i = 0; i < ISOTP_MAXLINKS; i++) {
+        isotp_link_t * link = &links[i];
+
+        if (link->tx_state == TX_WAIT_FC) {
+            if (--link->tx_wait == 0)
+                txDone(link, ISOTP_STATUS_TIMEOUT_BS);
+        } else if (link->tx_state == TX_SENDING) {
+            if ((link->tx_wait == 0) || (--link->tx_wait == 0))
+                sendConsecutive(link);
+        }
+
+        if ((link->rx_state == RX_RECEIVING) && (--link->rx_timer == 0))
+            rxFailed(link, ISOTP_STATUS_TIMEOUT_CR);
+    }
+}
+
+/**
+ * Take pending status and report it to the host as "xLss" (thread)
+ *
+ * @param index Link index
+ * @param status Pending status, reset to ISOTP_NONE
+ */
+void UT_Isotp::reportStatus(unsigned char index, volatile unsigned char * status) {
+    PORT_CAN_LOCK();
+    unsigned char value = *status;
+    *status = ISOTP_NONE;
+    PORT_CAN_UNLOCK();
+
+    if ((value == ISOTP_NONE) || dev.binary.mode)
+        return;
+    dev.txbuffer.putc('x');
+    dev.txbuffer.putc('0' + index);
+    dev.sendByteHex(value);
+    dev.txbuffer.putc(CR);
+}
+
+/**
+ * Report finished transfers to the host (thread): "xLss" with the
+ * status of a transmission or failed reception and "XLdd.." with a
+ * received PDU. In binary mode results are discarded.
+ */
+void UT_Isotp::poll(void) {
+    unsigned char i;
+    unsigned short pos;
+
+    for (i = 0; i < ISOTP_MAXLINKS; i++) {
+        isotp_link_t * link = &links[i];
+
+        if (link->tx_status != ISOTP_NONE)
+            reportStatus(i, &link->tx_status);
+        if (link->rx_status != ISOTP_NONE)
+            reportStatus(i, &link->rx_status);
+
+        if (link->rx_state == RX_READY) {
+            if (!dev.binary.mode) {
+                dev.txbuffer.putc('X');
+                dev.txbuffer.putc('0' + i);
+                for (pos = 0; pos < link->rx_len; pos++)
+                    dev.sendByteHex(link->rxbuf[pos]);
+                dev.txbuffer.putc(CR);
+            }
+            PORT_BARRIER();
+            link->rx_state = RX_IDLE;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/********************************************************************
+ File: UT_isotp.h
+
+ Description:
+ This file contains the ISO-TP (ISO 15765-2) offload definitions.
+ A link pairs a transmit and a receive identifier on one channel
+ (normal addressing, classic CAN frames). The device segments PDUs
+ sent by the host into first and consecutive frames, follows the
+ flow control of the peer and reassembles received PDUs, answering
+ with its own flow control frames at bus timing. The host only sees
+ whole PDUs.
+
+ Frames are handled in the CAN receive interrupt, timers and frame
+ pacing in the engine tick (see UT_Device::tick()).
+
+ ********************************************************************/
+#ifndef _ISOTP_
+#define _ISOTP_
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+#ifndef ISOTP_MAXLINKS
+#define ISOTP_MAXLINKS 2
+#endif
+
+// largest PDU, up to 4095 bytes with 12-bit first frame lengths
+#ifndef ISOTP_MAXPDU
+#define ISOTP_MAXPDU 4095
+#endif
+
+// time to wait for flow control (N_Bs) and consecutive frames (N_Cr), ms
+#ifndef ISOTP_TIMEOUT
+#define ISOTP_TIMEOUT 1000
+#endif
+
+#define ISOTP_NONE 0xFF
+
+#define ISOTP_EXTENDED 0x01     // link uses extended identifiers
+#define ISOTP_PADDING 0x02      // pad transmitted frames to 8 bytes
+
+// status reported to the host with "xLss"
+#define ISOTP_STATUS_DONE 0x00          // PDU sent
+#define ISOTP_STATUS_TIMEOUT_BS 0x01    // no flow control from the peer
+#define ISOTP_STATUS_OVERFLOW 0x02      // peer can't take the PDU
+#define ISOTP_STATUS_FAILED 0x03        // invalid flow control or queue full
+#define ISOTP_STATUS_TIMEOUT_CR 0x10    // consecutive frame missing
+#define ISOTP_STATUS_SEQUENCE 0x11      // wrong sequence number
+#define ISOTP_STATUS_LOST 0x12          // PDU received before the last was read
+
+typedef struct
+{
+    unsigned char open;
+    unsigned char channel;
+    unsigned char flags;            // ISOTP_* flags
+    unsigned long txid;
+    unsigned long rxid;
+    unsigned char bs;               // block size sent in our flow control
+    unsigned char stmin;            // STmin sent in our flow control
+
+    // transmit
+    volatile unsigned char tx_state;
+    volatile unsigned char tx_status;   // status to report, ISOTP_NONE if none
+    unsigned short tx_len;
+    unsigned short tx_pos;
+    unsigned char tx_sn;
+    unsigned char tx_bs;            // block size of the peer, 0 = no limit
+    unsigned char tx_blockleft;
+    unsigned short tx_gap;          // ticks between consecutive frames
+    unsigned long tx_wait;          // ticks until next frame or timeout
+
+    // receive
+    volatile unsigned char rx_state;
+    volatile unsigned char rx_status;
+    unsigned short rx_len;
+    unsigned short rx_pos;
+    unsigned char rx_sn;
+    unsigned char rx_blockleft;
+    unsigned long rx_timer;
+
+    unsigned char * txbuf;
+    unsigned char * rxbuf;
+} isotp_link_t;
+
+class UT_Device;
+
+class UT_Isotp {
+public:
+    UT_Isotp(UT_Device & dev, unsigned char (*txbufs)[ISOTP_MAXPDU],
+            unsigned char (*rxbufs)[ISOTP_MAXPDU]);
+
+    unsigned char open(unsigned char link, unsigned char channel, unsigned char flags,
+            unsigned long txid, unsigned long rxid, unsigned char bs, unsigned char stmin);
+    unsigned char close(unsigned char link);
+
+    unsigned char begin(unsigned char link);
+    void putHex(char ch);
+    unsigned char end(void);
+
+    unsigned char receive(unsigned char channel, canmsg_t * canmsg);
+    unsigned char active(void);
+    void tick(void);
+    void poll(void);
+
+private:
+    unsigned char sendFrame(isotp_link_t * link, const unsigned char * data, unsigned char len);
+    void sendFlowControl(isotp_link_t * link, unsigned char fs);
+    void txDone(isotp_link_t * link, unsigned char status);
+    void rxFailed(isotp_link_t * link, unsigned char status);
+    void sendConsecutive(isotp_link_t * link);
+    void receiveFlowControl(isotp_link_t * link, canmsg_t * canmsg);
+    void receiveData(isotp_link_t * link, canmsg_t * canmsg);
+    void reportStatus(unsigned char index, volatile unsigned char * status);
+
+    UT_Device & dev;
+
+    isotp_link_t links[ISOTP_MAXLINKS];
+
+    // hex data of the PDU the host is sending
+    unsigned char put_link;
+    unsigned char put_high;
+    unsigned char put_half;
+    unsigned char put_error;
+};
+
+#endif
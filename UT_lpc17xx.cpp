@@ -0,0 +1,185 @@
+/********************************************************************
+ File: UT_lpc17xx.cpp
+
+ Description:
+ This file contains the functions of the CAN port UT_LpcCan working
+ directly on the LPC17xx CAN controller and acceptance filter
+ registers.
+
+ Controllers run in transmit priority mode (MOD.TPM), where the
+ buffer with the lowest TFI priority field is sent first. Each loaded
+ frame gets the next value of a sequence counter, so up to three
+ frames can be in flight and still leave in load order. The counter
+ restarts whenever all buffers are idle. If it runs out before that,
+ loading pauses until the buffers drained.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "USBtin.h"
+#include "UT_lpc17xx.h"
+
+// controllers to write entries for, the table must be sorted by controller
+#if (USBTIN_CHANNELS > 1)
+#define SCC_FIRST 0
+#define SCC_LAST 1
+#else
+#define SCC_FIRST USBTIN_CAN
+#define SCC_LAST USBTIN_CAN
+#endif
+
+/**
+ * Load given frame into hardware transmit buffer and request transmission
+ *
+ * @param can Controller registers
+ * @param n Transmit buffer index (0..2)
+ * @param canmsg Frame to send
+ * @param prio Transmit priority, lower values are sent first
+ */
+static void loadBuffer(LPC_CAN_TypeDef * can, unsigned char n, canmsg_t * canmsg, unsigned char prio) {
+    volatile uint32_t * buf = &can->TFI1 + 4 * n;
+    unsigned char dlc = canmsg->dlc;
+    if (dlc > 8)
+        dlc = 8;
+
+    uint32_t tfi = ((uint32_t) dlc << 16) | prio;
+    if (canmsg->extended)
+        tfi |= CAN_TFI_FF;
+    if (canmsg->rtr)
+        tfi |= CAN_TFI_RTR;
+
+    // the payload is word aligned and both sides are little endian
+    uint32_t data[2];
+    memcpy(data, canmsg->data, 8);
+
+    buf[0] = tfi;
+    buf[1] = canmsg->id;
+    buf[2] = data[0];
+    buf[3] = data[1];
+
+    can->CMR = CAN_CMR_TR | CAN_CMR_STB(n);
+}
+
+/**
+ * Load given frame into a free transmit buffer.
+ * Frames leave in the order they were loaded.
+ *
+ * @param channel Channel index
+ * @param canmsg Frame to send
+ * @return 1 if loaded, 0 if no buffer is available
+ */
+unsigned char UT_LpcCan::sendFromIsr(unsigned char channel, canmsg_t * canmsg) {
+    channel_t * chan = &USBTIN_channels[channel];
+    unsigned long sr = chan->regs->SR;
+
+    if ((sr & CAN_SR_TBS_ALL) == CAN_SR_TBS_ALL)
+        chan->txprio = 0;
+    if (chan->txprio == CAN_TFI_PRIO_MAX)
+        return 0;
+
+    unsigned char n;
+    for (n = 0; n < 3; n++) {
+        if (sr & CAN_SR_TBS(n)) {
+            loadBuffer(chan->regs, n, canmsg, chan->txprio++);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write the acceptance filter lookup table and enable it.
+ * All channels share the filter, so every section holds one copy of
+ * the entries per controller. Called while all channels are closed,
+ * rewriting the table stops reception on both controllers.
+ *
+ * @param std Sorted standard id ranges, NULL to accept all frames
+ * @param std_count Count of standard ranges
+ * @param ext Sorted extended id ranges
+ * @param ext_count Count of extended ranges
+ * @return 1 on success, 0 if the table is too small (all frames are accepted then)
+ */
+unsigned char UT_LpcCan::setFilter(const idrange_t * std, unsigned short std_count,
+        const idrange_t * ext, unsigned short ext_count) {
+    volatile uint32_t * ram = LPC_CANAF_RAM->mask;
+    unsigned short w = 0;
+    unsigned short i;
+    unsigned long scc;
+
+    if (std == NULL) {
+        LPC_CANAF->AFMR = CANAF_AFMR_ACCBP;
+        return 1;
+    }
+
+    // table size per controller: paired standard ids, one word per
+    // standard range and extended id, two words per extended range
+    unsigned short std_single = 0, ext_single = 0;
+    for (i = 0; i < std_count; i++)
+        std_single += (std[i].lo == std[i].hi);
+    for (i = 0; i < ext_count; i++)
+        ext_single += (ext[i].lo == ext[i].hi);
+    unsigned short words = (std_single + 1) / 2 + (std_count - std_single)
+        + ext_single + 2 * (ext_count - ext_single);
+    if (words * (SCC_LAST - SCC_FIRST + 1) > CANAF_RAM_WORDS) {
+        LPC_CANAF->AFMR = CANAF_AFMR_ACCBP;
+        return 0;
+    }
+
+    LPC_CANAF->AFMR = CANAF_AFMR_ACCOFF;
+
+    // standard individual ids, two entries per word, first in upper half
+    LPC_CANAF->SFF_sa = 0;
+    unsigned long pending = 0;
+    unsigned char odd = 0;
+    for (scc = SCC_FIRST; scc <= SCC_LAST; scc++) {
+        for (i = 0; i < std_count; i++) {
+            unsigned long id;
+            if (std[i].lo != std[i].hi)
+                continue;
+            id = CANAF_STD_SCC(scc) | std[i].lo;
+            if (odd)
+                ram[w++] = (pending << 16) | id;
+            else
+                pending = id;
+            odd = !odd;
+        }
+    }
+    if (odd)
+        ram[w++] = (pending << 16) | CANAF_STD_PADDING;
+
+    // standard ranges, one per word, lower bound in upper half
+    LPC_CANAF->SFF_GRP_sa = w * 4;
+    for (scc = SCC_FIRST; scc <= SCC_LAST; scc++) {
+        for (i = 0; i < std_count; i++) {
+            if (std[i].lo == std[i].hi)
+                continue;
+            ram[w++] = ((CANAF_STD_SCC(scc) | std[i].lo) << 16)
+                | CANAF_STD_SCC(scc) | std[i].hi;
+        }
+    }
+
+    // extended individual ids
+    LPC_CANAF->EFF_sa = w * 4;
+    for (scc = SCC_FIRST; scc <= SCC_LAST; scc++) {
+        for (i = 0; i < ext_count; i++) {
+            if (ext[i].lo == ext[i].hi)
+                ram[w++] = CANAF_EXT_SCC(scc) | ext[i].lo;
+        }
+    }
+
+    // extended ranges, two words each
+    LPC_CANAF->EFF_GRP_sa = w * 4;
+    for (scc = SCC_FIRST; scc <= SCC_LAST; scc++) {
+        for (i = 0; i < ext_count; i++) {
+            if (ext[i].lo == ext[i].hi)
+                continue;
+            ram[w++] = CANAF_EXT_SCC(scc) | ext[i].lo;
+            ram[w++] = CANAF_EXT_SCC(scc) | ext[i].hi;
+        }
+    }
+
+    LPC_CANAF->ENDofTable = w * 4;
+    LPC_CANAF->AFMR = 0;
+    return 1;
+}
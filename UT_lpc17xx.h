@@ -0,0 +1,43 @@
+/********************************************************************
+ File: UT_lpc17xx.h
+
+ Description:
+ This file contains LPC17xx CAN controller register bit definitions
+ used where the mbed CAN driver is bypassed.
+
+ ********************************************************************/
+#ifndef _LPC17XX_
+#define _LPC17XX_
+
+#define CAN_MOD_RM (1 << 0)             // reset mode
+#define CAN_MOD_TPM (1 << 3)            // transmit priority mode
+
+#define CAN_CMR_TR (1 << 0)             // transmission request
+#define CAN_CMR_RRB (1 << 2)            // release receive buffer
+#define CAN_CMR_CDO (1 << 3)            // clear data overrun
+#define CAN_CMR_STB(n) (1 << (5 + (n))) // select transmit buffer n (0..2)
+
+#define CAN_GSR_RBS (1 << 0)            // receive buffer status
+#define CAN_GSR_DOS (1 << 1)            // data overrun status
+
+#define CAN_SR_TBS(n) (1 << (2 + 8 * (n)))  // transmit buffer n (0..2) released
+#define CAN_SR_TBS_ALL (CAN_SR_TBS(0) | CAN_SR_TBS(1) | CAN_SR_TBS(2))
+
+#define CAN_TFI_FF (1UL << 31)          // extended frame format
+#define CAN_TFI_RTR (1UL << 30)         // remote frame
+#define CAN_TFI_PRIO_MAX 0xFF
+
+#define CAN_RFS_FF (1UL << 31)          // extended frame format
+#define CAN_RFS_RTR (1UL << 30)         // remote frame
+#define CAN_RFS_DLC(rfs) (((rfs) >> 16) & 0x0F)
+
+#define CANAF_AFMR_ACCOFF (1 << 0)      // acceptance filter off, nothing received
+#define CANAF_AFMR_ACCBP (1 << 1)       // acceptance filter bypass, everything received
+
+#define CANAF_RAM_WORDS 512
+#define CANAF_STD_SCC(n) ((unsigned long) (n) << 13)   // standard entry controller number
+#define CANAF_STD_DISABLE (1 << 12)                     // standard entry disabled
+#define CANAF_STD_PADDING (CANAF_STD_SCC(7) | CANAF_STD_DISABLE | 0x7FF)
+#define CANAF_EXT_SCC(n) ((unsigned long) (n) << 29)   // extended entry controller number
+
+#endif
@@ -0,0 +1,55 @@
+/********************************************************************
+ File: UT_perf.cpp
+
+ Description:
+ This file contains the instrumentation functions. Each stage is
+ recorded from one context only: the CAN stages in the interrupt or
+ by the thread with the interrupt masked, all other stages by the
+ thread. No locking is needed on the hot path.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_perf.h"
+
+#if USBTIN_PERF
+
+UT_Perf::UT_Perf(void) {
+    memset((void *) counters, 0, sizeof(counters));
+    clearStages();
+}
+
+/**
+ * Record one pass of given stage
+ *
+ * @param stage PERF_* stage
+ * @param cycles Duration in port cycles
+ */
+void UT_Perf::record(unsigned char stage, uint32_t cycles) {
+    volatile perf_stage_t * s = &stages[stage];
+    s->count++;
+    s->sum += cycles;
+    if (cycles < s->min)
+        s->min = cycles;
+    if (cycles > s->max)
+        s->max = cycles;
+}
+
+/**
+ * Restart min/mean/max of all stages
+ */
+void UT_Perf::clearStages(void) {
+    unsigned char stage;
+
+    PORT_CAN_LOCK();
+    for (stage = 0; stage < PERF_STAGES; stage++) {
+        stages[stage].count = 0;
+        stages[stage].min = 0xFFFFFFFF;
+        stages[stage].max = 0;
+        stages[stage].sum = 0;
+    }
+    PORT_CAN_UNLOCK();
+}
+
+#endif
@@ -0,0 +1,81 @@
+/********************************************************************
+ File: UT_perf.h
+
+ Description:
+ This file contains the instrumentation definitions. Stages of the
+ frame path record their duration in port cycles (the DWT cycle
+ counter on the device, nanoseconds in the simulator) as count,
+ min, sum and max. Frame and drop counters are kept per channel.
+ Command 'P' reports everything in one response. Each engine has its
+ own records (UT_Device::perf), the probes name the object.
+
+ With USBTIN_PERF set to 0 all probes compile to nothing and 'P' is
+ rejected.
+
+ ********************************************************************/
+#ifndef _PERF_
+#define _PERF_
+
+#include <stdint.h>
+
+#include "UT_config.h"
+#include "UT_port.h"
+
+#ifndef USBTIN_PERF
+#define USBTIN_PERF 1
+#endif
+
+#define PERF_CANRX 0    // receive interrupt, per frame
+#define PERF_ENCODE 1   // ascii or binary encoding, per frame
+#define PERF_FLUSH 2    // handing a batch to the serial port
+#define PERF_PARSE 3    // command line or binary packet
+#define PERF_CANTX 4    // loading a transmit buffer, per frame
+#define PERF_STAGES 5
+
+typedef struct
+{
+    unsigned long count;
+    uint32_t min;
+    uint32_t max;
+    unsigned long long sum;
+} perf_stage_t;
+
+typedef struct
+{
+    unsigned long rx;               // frames received by the controller
+    unsigned long host;             // frames encoded for the host
+    unsigned long tx;               // frames loaded for transmission
+    unsigned long dropped_closed;   // received while the channel was closed
+    unsigned long dropped_txfull;   // transmit queue full
+    unsigned short tx_highwater;    // transmit queue high-water mark
+} perf_counters_t;
+
+#if USBTIN_PERF
+
+class UT_Perf {
+public:
+    UT_Perf(void);
+
+    void record(unsigned char stage, uint32_t cycles);
+    void clearStages(void);
+
+    volatile perf_stage_t stages[PERF_STAGES];
+    volatile perf_counters_t counters[USBTIN_CHANNELS];
+};
+
+#define PERF_BEGIN(t) uint32_t t = port_cycles()
+#define PERF_END(perf, stage, t) (perf).record(stage, port_cycles() - (t))
+#define PERF_COUNT(perf, channel, counter) ((perf).counters[channel].counter++)
+#define PERF_HIGHWATER(perf, channel, counter, value) \
+    do { if ((value) > (perf).counters[channel].counter) (perf).counters[channel].counter = (value); } while (0)
+
+#else
+
+#define PERF_BEGIN(t)
+#define PERF_END(perf, stage, t)
+#define PERF_COUNT(perf, channel, counter)
+#define PERF_HIGHWATER(perf, channel, counter, value)
+
+#endif
+
+#endif
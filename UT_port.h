@@ -0,0 +1,91 @@
+/********************************************************************
+ File: UT_port.h
+
+ Description:
+ This file contains the port interface definitions. The protocol
+ engine only talks to the hardware through port objects handed to
+ its class template (see UT_engine.h), so it can be built for the
+ LPC1768 with mbed (USBtin.cpp, UT_lpc17xx.cpp) or on a workstation
+ against the simulator in sim/ (USBTIN_HOST). The template calls the
+ port objects directly, so their inline member functions end up in
+ the engine's hot paths.
+
+ A CAN port provides:
+   unsigned char frequency(unsigned char channel, unsigned long hz);
+   void open(unsigned char channel, unsigned char mode);  // PORT_CAN_*
+   void close(unsigned char channel);
+   unsigned char sendFromIsr(unsigned char channel, canmsg_t * canmsg);
+   unsigned char setFilter(const idrange_t * std, unsigned short std_count,
+           const idrange_t * ext, unsigned short ext_count);
+ sendFromIsr loads a free transmit buffer (0 if none is free) and may
+ be called from the CAN interrupt; setFilter loads the acceptance
+ filter, std NULL accepting all frames.
+
+ A serial port provides:
+   void write(const char * buf, unsigned short len);
+   unsigned short peek(char ** data, unsigned char * more);
+   void consume(unsigned short len);
+   void setBaud(unsigned long baud);
+ Writes block while the link is busy. Received characters are read in
+ place: peek returns the characters up to the end of the receive ring
+ (more is set if others follow at its start), consume releases them.
+ setBaud changes the link rate after the output written so far has
+ been sent, transports without a rate ignore it. A port that has to
+ discard received characters puts PORT_SERIAL_LOST in their place
+ once there is room again, so the engine drops the damaged command.
+
+ A clock provides:
+   uint32_t micros(void);                  // free running 1 MHz counter
+   void timerStart(uint32_t delay_us);     // one-shot timer
+   void signal(int32_t signals);           // wake the thread, UT_SIGNAL_*
+ Restarting the timer replaces the pending expiry.
+
+ The port calls back into its engine with canReceiveSlot(),
+ canReceive() and canOverrun() from its CAN receive interrupt, with
+ txqueue.isr() whenever a transmit buffer became free, with tick()
+ every CYCLIC_TICK_US and with timer() when the one-shot timer
+ expires. These interrupts must not preempt each other.
+ serialReceived() is called from the serial receive interrupt at any
+ priority.
+
+ ********************************************************************/
+#ifndef _PORT_
+#define _PORT_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "UT_CANMessage.h"
+#include "UT_idrange.h"
+
+#ifdef USBTIN_HOST
+// the simulator runs interrupts and thread on one host thread
+#define PORT_CAN_LOCK()
+#define PORT_CAN_UNLOCK()
+#define PORT_BARRIER()
+#define PORT_BULK0
+#define PORT_BULK1
+#else
+#include "mbed.h"
+// mask the CAN interrupt shared by both controllers and the us ticker
+// interrupt driving the cyclic scheduler (same priority, so neither
+// preempts the other)
+#define PORT_CAN_LOCK() do { NVIC_DisableIRQ(CAN_IRQn); NVIC_DisableIRQ(TIMER3_IRQn); } while (0)
+#define PORT_CAN_UNLOCK() do { NVIC_EnableIRQ(TIMER3_IRQn); NVIC_EnableIRQ(CAN_IRQn); } while (0)
+#define PORT_BARRIER() __DMB()
+// large buffers go to the two 16 KB AHB SRAM banks, not zeroed at startup
+#define PORT_BULK0 __attribute__((section("AHBSRAM0"), aligned))
+#define PORT_BULK1 __attribute__((section("AHBSRAM1"), aligned))
+#endif
+
+// stands in for received characters the serial port had to discard
+#define PORT_SERIAL_LOST 0
+
+#define PORT_CAN_NORMAL 0
+#define PORT_CAN_LISTEN 1
+
+// free running cycle counter for instrumentation, see UT_perf.h; one
+// counter per processor, shared by all engines
+uint32_t port_cycles(void);
+
+#endif
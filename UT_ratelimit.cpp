@@ -0,0 +1,152 @@
+/********************************************************************
+ File: UT_ratelimit.cpp
+
+ Description:
+ This file contains the receive rate limiting functions.
+ Rules are checked in the order they were added, the first match
+ wins. Frame counter and time of the last passed frame are kept per
+ id in an UT_idhash table; ids that don't fit share the
+ state of their rule. Rules and state are changed from the thread
+ with the CAN interrupt masked.
+ check() only decides; the state of a passed frame is updated by
+ commit() once the frame was stored in the receive buffer, in the same
+ receive interrupt.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_ratelimit.h"
+
+#include "UT_port.h"
+#include "UT_idhash.h"
+
+#if !IDHASH_SIZE_VALID(RATELIMIT_TABLE_SIZE)
+#error "RATELIMIT_TABLE_SIZE must be a power of two not greater than 32768"
+#endif
+
+UT_RateLimit::UT_RateLimit(void) {
+    count = 0;
+    memset(table, 0, sizeof(table));
+    pending = NULL;
+    memset((void *) decimated, 0, sizeof(decimated));
+}
+
+/**
+ * Find state of given id, inserting it if missing
+ *
+ * @param key Table key
+ * @return State, NULL if the table is full
+ */
+ratelimit_state_t * UT_RateLimit::lookup(uint32_t key) {
+    unsigned short slot = idhash_find(table, sizeof(ratelimit_state_t), RATELIMIT_TABLE_SIZE, key);
+    if (slot == RATELIMIT_TABLE_SIZE)
+        return NULL;
+
+    ratelimit_state_t * state = &table[slot];
+    state->key = key;
+    return state;
+}
+
+/**
+ * Append rule
+ *
+ * @param rule Rule to add
+ * @return 1 on success, 0 on invalid channel or full rule table
+ */
+unsigned char UT_RateLimit::add(ratelimit_rule_t * rule) {
+    if ((rule->channel >= USBTIN_CHANNELS) || (rule->lo > rule->hi))
+        return 0;
+    if (count >= RATELIMIT_MAXRULES)
+        return 0;
+
+    PORT_CAN_LOCK();
+    rules[count] = *rule;
+    memset(&shared[count], 0, sizeof(ratelimit_state_t));
+    pending = NULL;
+    count++;
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Remove all rules and per id state, reset statistics
+ */
+void UT_RateLimit::clear(void) {
+    unsigned char channel;
+
+    PORT_CAN_LOCK();
+    count = 0;
+    memset(table, 0, sizeof(table));
+    pending = NULL;
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++)
+        decimated[channel] = 0;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Find the first matching rule and apply it (receive interrupt).
+ * Frames within the interval of the last passed one are decimated
+ * without counting them, of the others only every divisor'th is
+ * passed.
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @param now Reception time in us
+ * @return 1 to pass the frame, 0 if it is decimated
+ */
+unsigned char UT_RateLimit::check(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    unsigned char extended = canmsg->extended;
+    unsigned long id = canmsg->id;
+    unsigned char i;
+
+    pending = NULL;
+    for (i = 0; i < count; i++) {
+        ratelimit_rule_t * rule = &rules[i];
+        if ((rule->channel == channel) && (rule->extended == extended)
+                && (id >= rule->lo) && (id <= rule->hi))
+            break;
+    }
+    if (i == count)
+        return 1;
+
+    ratelimit_rule_t * rule = &rules[i];
+    ratelimit_state_t * state = lookup(idhash_key(channel, id, extended));
+    if (state == NULL)
+        state = &shared[i];
+
+    if (rule->interval && state->passed
+            && ((uint32_t) (now - state->last_us) < rule->interval * 1000UL)) {
+        decimated[channel]++;
+        return 0;
+    }
+
+    if (state->count != 0) {
+        if (++state->count >= rule->divisor)
+            state->count = 0;
+        decimated[channel]++;
+        return 0;
+    }
+
+    pending = state;
+    pending_divisor = rule->divisor;
+    return 1;
+}
+
+/**
+ * Start decimation of the id of the frame passed by the last check()
+ * (receive interrupt)
+ *
+ * @param now Reception time in us
+ */
+void UT_RateLimit::commit(uint32_t now) {
+    ratelimit_state_t * state = pending;
+
+    if (state == NULL)
+        return;
+    pending = NULL;
+
+    state->count = (pending_divisor > 1) ? 1 : 0;
+    state->last_us = now;
+    state->passed = 1;
+}
@@ -0,0 +1,101 @@
+/********************************************************************
+ File: UT_ratelimit.h
+
+ Description:
+ This file contains the receive rate limiting definitions. Rules
+ match an id range of one channel and pass only every Nth frame of
+ each id and/or at most one frame of each id per interval. They are
+ applied in the receive interrupt before buffering, so high rate ids
+ can't crowd low rate ids out of the receive buffer. A passed frame
+ only counts once it was stored in the receive buffer (delivered()),
+ so a frame lost to a full buffer doesn't start a new interval.
+
+ ********************************************************************/
+#ifndef _RATELIMIT_
+#define _RATELIMIT_
+
+#include <stdint.h>
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+#ifndef RATELIMIT_MAXRULES
+#define RATELIMIT_MAXRULES 16
+#endif
+
+// ids with own decimation state, must be a power of two
+#ifndef RATELIMIT_TABLE_SIZE
+#define RATELIMIT_TABLE_SIZE 128
+#endif
+
+typedef struct
+{
+    unsigned char channel;
+    unsigned char extended;     // 1 for extended ids
+    unsigned long lo;           // first id
+    unsigned long hi;           // last id
+    unsigned short divisor;     // pass 1 of divisor frames, 0 or 1 = all
+    unsigned short interval;    // pass at most one frame per interval ms, 0 = no limit
+} ratelimit_rule_t;
+
+typedef struct
+{
+    uint32_t key;               // id, format and channel, 0 if unused
+    uint32_t last_us;           // time a frame of the id was last passed
+    unsigned short count;       // frames since the last passed one
+    unsigned char passed;       // last_us is valid
+} ratelimit_state_t;
+
+class UT_RateLimit {
+public:
+    UT_RateLimit(void);
+
+    unsigned char add(ratelimit_rule_t * rule);
+    void clear(void);
+
+    unsigned char check(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    inline unsigned char accept(unsigned char channel, canmsg_t * canmsg, uint32_t now);
+    void commit(uint32_t now);
+    inline void delivered(uint32_t now);
+
+    volatile unsigned char count;
+    volatile unsigned long decimated[USBTIN_CHANNELS];
+
+private:
+    ratelimit_state_t * lookup(uint32_t key);
+
+    ratelimit_rule_t rules[RATELIMIT_MAXRULES];
+    ratelimit_state_t shared[RATELIMIT_MAXRULES];
+    ratelimit_state_t table[RATELIMIT_TABLE_SIZE];
+
+    // state of the frame last passed by check(), NULL if none
+    ratelimit_state_t * pending;
+    unsigned short pending_divisor;
+};
+
+/**
+ * Apply rate limiting rules to given frame (receive interrupt)
+ *
+ * @param channel Channel the frame was received on
+ * @param canmsg Received frame
+ * @param now Reception time in us
+ * @return 1 to pass the frame, 0 if it is decimated
+ */
+inline unsigned char UT_RateLimit::accept(unsigned char channel, canmsg_t * canmsg, uint32_t now) {
+    if (count == 0)
+        return 1;
+    return check(channel, canmsg, now);
+}
+
+/**
+ * Count the frame passed by accept() once it was stored in the
+ * receive buffer (receive interrupt)
+ *
+ * @param now Reception time in us
+ */
+inline void UT_RateLimit::delivered(uint32_t now) {
+    if (count)
+        commit(now);
+}
+
+#endif
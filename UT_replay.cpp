@@ -0,0 +1,244 @@
+/********************************************************************
+ File: UT_replay.cpp
+
+ Description:
+ This file contains the timed trace replay functions.
+ The staging ring works like the receive buffers: the thread only
+ ever writes putpos and the timer interrupt only ever writes getpos,
+ so the host can refill the part already played while the rest is
+ still being sent.
+
+ The timer interrupt queues all frames that are due and restarts
+ the port's one-shot timer for the next one. While the ring is empty
+ the timer is idle; the thread calls the handler itself with the CAN
+ interrupt masked when a frame arrives, so the timer is armed again.
+
+ ********************************************************************/
+
+#include "UT_replay.h"
+
+#include "UT_core.h"
+
+#if (REPLAY_BUFFERSIZE & (REPLAY_BUFFERSIZE - 1)) || (REPLAY_BUFFERSIZE > 32768)
+#error "REPLAY_BUFFERSIZE must be a power of two not greater than 32768"
+#endif
+
+// the ring shares a RAM bank with the ISO-TP transmit buffers, records take 24 bytes
+#if (ISOTP_MAXLINKS * ISOTP_MAXPDU + REPLAY_BUFFERSIZE * 24 > 16384)
+#error "ISO-TP transmit buffers and the replay ring must fit into a 16 KB RAM bank"
+#endif
+
+#define REPLAY_MASK (REPLAY_BUFFERSIZE - 1)
+
+UT_Replay::UT_Replay(UT_Device & dev, replay_record_t * ring) : dev(dev), ring(ring) {
+    start_us = 0;
+    reset();
+}
+
+/**
+ * Reset the statistics
+ */
+void UT_Replay::clearStats(void) {
+    stats.sent = 0;
+    stats.dropped = 0;
+    stats.underruns = 0;
+    stats.late_min = 0xFFFFFFFFUL;
+    stats.late_max = 0;
+    stats.late_sum = 0;
+}
+
+/**
+ * Arm the one-shot timer
+ *
+ * @param delay_us Time from now, at least 1
+ */
+void UT_Replay::arm(uint32_t delay_us) {
+    armed = 1;
+    dev.timerStart(delay_us);
+}
+
+/**
+ * Empty the ring and stop the replay
+ */
+void UT_Replay::reset(void) {
+    putpos = 0;
+    getpos = 0;
+    ended = 0;
+    armed = 0;
+    finished = 0;
+    last_offset = 0;
+    state = REPLAY_IDLE;
+    clearStats();
+}
+
+/**
+ * Append frame to the trace (thread). Frames arriving after their
+ * due time are sent at once and counted as underrun.
+ *
+ * @param channel Channel to transmit on
+ * @param offset Time from the start of the replay in us, not below the previous frame's
+ * @param canmsg Frame to send
+ * @return 1 on success, 0 if the ring is full, the end was marked or the offset is invalid
+ */
+unsigned char UT_Replay::put(unsigned char channel, unsigned long offset, canmsg_t * canmsg) {
+    unsigned short pos = putpos;
+
+    if ((channel >= USBTIN_CHANNELS) || ended || (offset < last_offset))
+        return 0;
+    if ((unsigned short) (pos - getpos) >= REPLAY_BUFFERSIZE)
+        return 0;
+
+    ring[pos & REPLAY_MASK].canmsg = *canmsg;
+    ring[pos & REPLAY_MASK].offset = offset;
+    ring[pos & REPLAY_MASK].channel = channel;
+    last_offset = offset;
+    PORT_BARRIER();
+    putpos = pos + 1;
+
+    if (state == REPLAY_PLAYING) {
+        PORT_CAN_LOCK();
+        if ((int32_t) (start_us + offset - dev.micros()) < 0)
+            stats.underruns++;
+        if (!armed)
+            timer();
+        PORT_CAN_UNLOCK();
+    }
+    return 1;
+}
+
+/**
+ * Get count of free ring slots
+ *
+ * @return Free slots
+ */
+unsigned short UT_Replay::free(void) {
+    return REPLAY_BUFFERSIZE - (unsigned short) (putpos - getpos);
+}
+
+/**
+ * Start the replay, offsets count from now. The ring should hold
+ * enough frames to cover the time the host needs to refill it.
+ *
+ * @return 1 on success, 0 if already started
+ */
+unsigned char UT_Replay::start(void) {
+    if (state != REPLAY_IDLE)
+        return 0;
+
+    PORT_CAN_LOCK();
+    start_us = dev.micros();
+    state = REPLAY_PLAYING;
+    timer();
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Mark the end of the trace, the replay finishes once the ring is empty
+ *
+ * @return 1 on success, 0 if the end was already marked
+ */
+unsigned char UT_Replay::end(void) {
+    if (ended)
+        return 0;
+
+    PORT_CAN_LOCK();
+    ended = 1;
+    if ((state == REPLAY_PLAYING) && !armed)
+        timer();
+    PORT_CAN_UNLOCK();
+    return 1;
+}
+
+/**
+ * Stop the replay, discard the trace and reset the statistics.
+ * A pending timer expiry finds the replay stopped and is ignored.
+ */
+void UT_Replay::clear(void) {
+    PORT_CAN_LOCK();
+    reset();
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Queue all due frames and arm the timer for the next one. Called on
+ * timer expiry in interrupt context and by the thread with the CAN
+ * interrupt masked. Frames of closed channels are dropped, a full
+ * transmit queue is retried after REPLAY_RETRY_US.
+ */
+void UT_Replay::timer(void) {
+    armed = 0;
+    if (state != REPLAY_PLAYING)
+        return;
+
+    uint32_t now = dev.micros();
+    unsigned short pos = getpos;
+
+    while (pos != putpos) {
+        replay_record_t * record = &ring[pos & REPLAY_MASK];
+        int32_t late = (int32_t) (now - (start_us + record->offset));
+
+        if (late < 0) {
+            arm(-late);
+            return;
+        }
+        if (dev.state[record->channel] != STATE_OPEN) {
+            stats.dropped++;
+        } else if (!dev.txqueue.putFromIsr(record->channel, &record->canmsg)) {
+            arm(REPLAY_RETRY_US);
+            return;
+        } else {
+            stats.sent++;
+            stats.late_sum += late;
+            if ((unsigned long) late < stats.late_min)
+                stats.late_min = late;
+            if ((unsigned long) late > stats.late_max)
+                stats.late_max = late;
+        }
+        pos++;
+        getpos = pos;
+    }
+
+    if (ended) {
+        state = REPLAY_DONE;
+        finished = 1;
+        dev.signal(UT_SIGNAL_CANRX);
+    }
+}
+
+/**
+ * Queue replay status for sending: "pSffffssssssssdddddddduuuuuuuu"
+ * followed by the minimum, mean and maximum timing error in us
+ * (state, free slots, frames sent, dropped and underruns)
+ */
+void UT_Replay::sendStatus(void) {
+    replay_stats_t snapshot;
+
+    PORT_CAN_LOCK();
+    snapshot = *(replay_stats_t *) &stats;
+    PORT_CAN_UNLOCK();
+
+    dev.txbuffer.putc('p');
+    dev.sendHex(state, 1);
+    dev.sendHex(free(), 4);
+    dev.sendHex(snapshot.sent, 8);
+    dev.sendHex(snapshot.dropped, 8);
+    dev.sendHex(snapshot.underruns, 8);
+    dev.sendHex(snapshot.sent ? snapshot.late_min : 0, 8);
+    dev.sendHex(snapshot.sent ? (unsigned long) (snapshot.late_sum / snapshot.sent) : 0, 8);
+    dev.sendHex(snapshot.late_max, 8);
+}
+
+/**
+ * Report the end of the replay to the host (thread) with the status
+ * line. In binary mode the report is discarded.
+ */
+void UT_Replay::poll(void) {
+    if (!finished)
+        return;
+    finished = 0;
+    if (dev.binary.mode)
+        return;
+    sendStatus();
+    dev.txbuffer.putc(CR);
+}
@@ -0,0 +1,93 @@
+/********************************************************************
+ File: UT_replay.h
+
+ Description:
+ This file contains the timed trace replay definitions. The host
+ uploads a captured trace as frames with time offsets into a staging
+ ring on the device, starts the replay and keeps refilling the ring
+ while it plays, so traces of any length can be streamed. Frames are
+ queued for transmission from the port's one-shot timer interrupt at
+ their offsets from the start, independent of the serial link.
+
+ Timing errors (time of queueing minus the recorded offset) are
+ collected and reported when the trace has been played.
+
+ ********************************************************************/
+#ifndef _REPLAY_
+#define _REPLAY_
+
+#include <stdint.h>
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+// staging ring depth in frames, power of two
+#ifndef REPLAY_BUFFERSIZE
+#define REPLAY_BUFFERSIZE 256
+#endif
+
+// retry interval while the transmit queue of a frame is full, us
+#ifndef REPLAY_RETRY_US
+#define REPLAY_RETRY_US 100
+#endif
+
+#define REPLAY_IDLE 0       // loading, not started
+#define REPLAY_PLAYING 1
+#define REPLAY_DONE 2       // end marked and all frames played
+
+typedef struct
+{
+    unsigned long sent;         // frames queued for transmission
+    unsigned long dropped;      // frames of closed channels
+    unsigned long underruns;    // ring ran empty before the end was marked
+    unsigned long late_min;     // timing error, us
+    unsigned long late_max;
+    unsigned long long late_sum;
+} replay_stats_t;
+
+typedef struct
+{
+    canmsg_t canmsg;
+    unsigned long offset;       // us from the start of the replay
+    unsigned char channel;
+} replay_record_t;
+
+class UT_Device;
+
+class UT_Replay {
+public:
+    UT_Replay(UT_Device & dev, replay_record_t * ring);
+
+    unsigned char put(unsigned char channel, unsigned long offset, canmsg_t * canmsg);
+    unsigned short free(void);
+    unsigned char start(void);
+    unsigned char end(void);
+    void clear(void);
+
+    void timer(void);
+    void sendStatus(void);
+    void poll(void);
+
+    volatile unsigned char state;
+    volatile replay_stats_t stats;
+
+private:
+    void reset(void);
+    void clearStats(void);
+    void arm(uint32_t delay_us);
+
+    UT_Device & dev;
+
+    // staging ring of REPLAY_BUFFERSIZE records
+    replay_record_t * const ring;
+    volatile unsigned short putpos;
+    volatile unsigned short getpos;
+
+    volatile unsigned char ended;
+    volatile unsigned char armed;
+    volatile unsigned char finished;
+    uint32_t start_us;
+    unsigned long last_offset;
+};
+
+#endif
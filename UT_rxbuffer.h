@@ -0,0 +1,202 @@
+/********************************************************************
+ File: UT_rxbuffer.h
+
+ Description:
+ This file contains the receive ring buffers. Each channel has a
+ ring that is filled by the CAN receive interrupt (single producer)
+ and drained by the main thread (single consumer) without locking.
+
+ The producer only ever writes canpos and the consumer only ever
+ writes usbpos, so no interrupt masking is needed. Both positions
+ are free running and masked on access, which requires the buffer
+ size to be a power of two. Depth and overflow policy are template
+ parameters, so the engine gets all of it inline with constant masks.
+
+ With OVERFLOW_DROP_OLDEST the producer reclaims the oldest slot when
+ the buffer is full. The consumer then takes each message out as a
+ copy with the CAN interrupt masked, as the slot it reads may be
+ reclaimed at any time.
+
+ ********************************************************************/
+#ifndef _RXBUFFER_
+#define _RXBUFFER_
+
+#include "UT_config.h"
+#include "UT_port.h"
+#include "UT_CANMessage.h"
+
+// receive statistics, written by the receive interrupt only
+typedef struct
+{
+    unsigned long dropped_full;         // frames lost to a full buffer
+    unsigned long dropped_overrun;      // frames lost in the CAN controller
+    unsigned short highwater;           // highest fill level seen
+    unsigned char overrun;              // loss since last status read
+} rxbuffer_stats_t;
+
+template <unsigned short Size, unsigned char Policy>
+class UT_RxBuffer {
+public:
+    static_assert(((Size & (Size - 1)) == 0) && (Size <= 32768),
+        "receive buffer size must be a power of two not greater than 32768");
+
+    UT_RxBuffer(volatile rxbuffer_stats_t * stats) : stats(stats) {
+        unsigned char channel;
+
+        for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+            ring[channel].canpos = 0;
+            ring[channel].usbpos = 0;
+        }
+    }
+
+    /**
+     * Get the next free slot without claiming it (producer side). The
+     * receive interrupt reads frames straight into it; the slot is only
+     * published by put(), so frames rejected later cost nothing.
+     *
+     * @param channel Channel index
+     * @return Pointer to free slot, NULL if the buffer is full
+     */
+    canmsg_t * peekWritePtr(unsigned char channel) {
+        rxring_t * r = &ring[channel];
+        unsigned short canpos = r->canpos;
+        if ((unsigned short) (canpos - r->usbpos) >= Size)
+            return NULL;
+        return &r->buffer[canpos & (Size - 1)];
+    }
+
+    /**
+     * Get the next free slot (producer side).
+     * A full buffer is handled according to the overflow policy.
+     *
+     * @param channel Channel index
+     * @return Pointer to free slot, NULL if the new message is to be dropped
+     */
+    canmsg_t * getWritePtr(unsigned char channel) {
+        rxring_t * r = &ring[channel];
+        unsigned short canpos = r->canpos;
+        if ((unsigned short) (canpos - r->usbpos) >= Size) {
+            stats[channel].dropped_full++;
+            stats[channel].overrun = 1;
+            if (Policy != OVERFLOW_DROP_OLDEST)
+                return NULL;
+            r->usbpos = r->usbpos + 1;
+        }
+        return &r->buffer[canpos & (Size - 1)];
+    }
+
+    /**
+     * Publish the slot returned by getWritePtr (producer side)
+     *
+     * @param channel Channel index
+     */
+    void commit(unsigned char channel) {
+        rxring_t * r = &ring[channel];
+
+        // slot content must be visible before the new position
+        PORT_BARRIER();
+        unsigned short canpos = r->canpos + 1;
+        r->canpos = canpos;
+
+        unsigned short filled = canpos - r->usbpos;
+        if (filled > stats[channel].highwater)
+            stats[channel].highwater = filled;
+    }
+
+    /**
+     * Store given frame (producer side). A frame read into the slot of
+     * peekWritePtr() is published in place, others are copied.
+     *
+     * @param channel Channel index
+     * @param canmsg Frame to store
+     * @return 1 if stored, 0 if dropped on a full buffer
+     */
+    unsigned char put(unsigned char channel, canmsg_t * canmsg) {
+        canmsg_t * slot = peekWritePtr(channel);
+
+        if (slot != canmsg) {
+            slot = getWritePtr(channel);
+            if (slot == NULL)
+                return 0;
+            *slot = *canmsg;
+        }
+        commit(channel);
+        return 1;
+    }
+
+    /**
+     * Count a message lost before it reached the buffer (producer side)
+     *
+     * @param channel Channel index
+     */
+    void countOverrun(unsigned char channel) {
+        stats[channel].dropped_overrun++;
+        stats[channel].overrun = 1;
+    }
+
+    /**
+     * Get the oldest filled slot (consumer side)
+     *
+     * @param channel Channel index
+     * @return Pointer to oldest message, NULL if buffer is empty
+     */
+    canmsg_t * getReadPtr(unsigned char channel) {
+        rxring_t * r = &ring[channel];
+
+        if (Policy == OVERFLOW_DROP_OLDEST) {
+            canmsg_t * canmsg = NULL;
+            PORT_CAN_LOCK();
+            unsigned short usbpos = r->usbpos;
+            if (r->canpos != usbpos) {
+                shadow = r->buffer[usbpos & (Size - 1)];
+                r->usbpos = usbpos + 1;
+                canmsg = &shadow;
+            }
+            PORT_CAN_UNLOCK();
+            return canmsg;
+        }
+
+        unsigned short usbpos = r->usbpos;
+        if (r->canpos == usbpos)
+            return NULL;
+        PORT_BARRIER();
+        return &r->buffer[usbpos & (Size - 1)];
+    }
+
+    /**
+     * Free the slot returned by getReadPtr (consumer side)
+     *
+     * @param channel Channel index
+     */
+    void release(unsigned char channel) {
+        if (Policy == OVERFLOW_DROP_OLDEST)
+            return;
+        // finish reading the slot before handing it back to the producer
+        PORT_BARRIER();
+        ring[channel].usbpos = ring[channel].usbpos + 1;
+    }
+
+    /**
+     * Get count of messages waiting in the buffer
+     *
+     * @param channel Channel index
+     * @return Count of filled slots
+     */
+    unsigned short filled(unsigned char channel) {
+        return ring[channel].canpos - ring[channel].usbpos;
+    }
+
+private:
+    typedef struct
+    {
+        canmsg_t buffer[Size];
+        volatile unsigned short canpos;
+        volatile unsigned short usbpos;
+    } rxring_t;
+
+    rxring_t ring[USBTIN_CHANNELS];
+    canmsg_t shadow;        // copy handed out with OVERFLOW_DROP_OLDEST
+    volatile rxbuffer_stats_t * const stats;
+};
+
+#endif
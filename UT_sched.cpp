@@ -0,0 +1,160 @@
+/********************************************************************
+ File: UT_sched.cpp
+
+ Description:
+ This file contains the main loop scheduler functions.
+ The serial receive interrupt stamps the arrival of the first
+ character not yet seen by the thread; the thread takes the stamp at
+ the start of the input handling and owns all statistics. A stamp
+ written between taking and clearing it is lost, the characters are
+ then accounted with the next arrival.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_sched.h"
+
+#include "UT_core.h"
+
+#define SCHED_HIST_MAXEXP 23
+
+
+/**
+ * Get histogram bucket of given latency
+ *
+ * @param us Latency
+ * @return Bucket index
+ */
+static unsigned char bucket(uint32_t us) {
+    unsigned char exp = 2;
+
+    if (us < 4)
+        return us;
+    if (us >> (SCHED_HIST_MAXEXP + 1))
+        us = (1UL << (SCHED_HIST_MAXEXP + 1)) - 1;
+    while (us >> (exp + 1))
+        exp++;
+    return (exp - 1) * 4 + ((us >> (exp - 2)) & 3);
+}
+
+/**
+ * Get largest latency of given histogram bucket
+ *
+ * @param index Bucket index
+ * @return Latency, us
+ */
+static uint32_t bucketLimit(unsigned char index) {
+    unsigned char exp = index / 4 + 1;
+
+    if (index < 4)
+        return index;
+    return ((uint32_t) (4 + (index & 3) + 1) << (exp - 2)) - 1;
+}
+
+UT_Sched::UT_Sched(UT_Device & dev) : dev(dev) {
+    config.rx_budget = SCHED_RX_BUDGET;
+    config.cmd_budget = SCHED_CMD_BUDGET;
+    config.yield_us = SCHED_YIELD_US;
+    clear();
+    input_pending = 0;
+    input_since = 0;
+}
+
+/**
+ * Clear the statistics (thread)
+ */
+void UT_Sched::clear(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * Note received characters (serial interrupt)
+ *
+ * @param now Arrival time in us
+ */
+void UT_Sched::inputArrived(uint32_t now) {
+    if (input_pending)
+        return;
+    input_since = now;
+    PORT_BARRIER();
+    input_pending = 1;
+}
+
+/**
+ * Record the latency of the characters received since the last call
+ * (thread, before handling the input)
+ */
+void UT_Sched::inputBegin(void) {
+    if (!input_pending)
+        return;
+    uint32_t since = input_since;
+    input_pending = 0;
+
+    uint32_t latency = dev.micros() - since;
+    stats.samples++;
+    stats.hist[bucket(latency)]++;
+    if (latency > stats.max)
+        stats.max = latency;
+}
+
+/**
+ * Check if sending frames to the host should stop for this pass
+ * (thread)
+ *
+ * @param frames Frames sent in this pass
+ * @return 1 if the frame budget is used up or received characters waited too long
+ */
+unsigned char UT_Sched::rxYield(unsigned short frames) {
+    if ((config.rx_budget && (frames >= config.rx_budget))
+            || (config.yield_us && input_pending
+                && ((uint32_t) (dev.micros() - input_since) >= config.yield_us))) {
+        stats.rx_yields++;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Get a percentile of the command latency
+ *
+ * @param permille Share of samples at or below the result, 1..1000
+ * @return Latency in us, rounded up to the bucket limit, 0 without samples
+ */
+uint32_t UT_Sched::percentile(unsigned short permille) {
+    unsigned long rank = ((unsigned long long) stats.samples * permille + 999) / 1000;
+    unsigned long count = 0;
+    unsigned char i;
+
+    if (stats.samples == 0)
+        return 0;
+    for (i = 0; i < SCHED_HIST_SIZE; i++) {
+        count += stats.hist[i];
+        if (count >= rank)
+            break;
+    }
+    uint32_t limit = bucketLimit(i);
+    return (limit < stats.max) ? limit : stats.max;
+}
+
+/**
+ * Queue scheduler status for sending: "kRRRRCCCCYYYY" (budgets)
+ * followed by "nnnnnnnn" samples, the 50th, 90th and 99th percentile
+ * and the maximum command latency in us, the count of passes that
+ * stopped sending frames early or left commands for the next one, and
+ * the count of command lines damaged by lost input (8 digits each)
+ */
+void UT_Sched::sendStatus(void) {
+    dev.txbuffer.putc('k');
+    dev.sendHex(config.rx_budget, 4);
+    dev.sendHex(config.cmd_budget, 4);
+    dev.sendHex(config.yield_us, 4);
+    dev.sendHex(stats.samples, 8);
+    dev.sendHex(percentile(500), 8);
+    dev.sendHex(percentile(900), 8);
+    dev.sendHex(percentile(990), 8);
+    dev.sendHex(stats.max, 8);
+    dev.sendHex(stats.rx_yields, 8);
+    dev.sendHex(stats.cmd_yields, 8);
+    dev.sendHex(stats.input_lost, 8);
+}
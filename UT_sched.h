@@ -0,0 +1,91 @@
+/********************************************************************
+ File: UT_sched.h
+
+ Description:
+ This file contains the main loop scheduler definitions. Each pass
+ of the main loop first handles host commands, then sends received
+ frames to the host. Both directions get a budget per pass, so a
+ saturated bus no longer keeps commands waiting behind an unbounded
+ drain of the receive buffers:
+
+ - at most rx_budget frames are sent to the host per pass
+ - at most cmd_budget command lines are handled per pass
+ - sending frames stops early once received characters have waited
+   yield_us
+
+ A pass that leaves work behind signals the thread again, so the
+ next pass follows at once. The ratio of the two budgets weights the
+ directions under load, yield_us bounds the command latency.
+
+ The command latency (first received character to the pass handling
+ it) is collected in a histogram with four buckets per power of two,
+ so percentiles are reported within 25 %.
+
+ ********************************************************************/
+#ifndef _SCHED_
+#define _SCHED_
+
+#include <stdint.h>
+
+// frames sent to the host per pass, 0 for no limit
+#ifndef SCHED_RX_BUDGET
+#define SCHED_RX_BUDGET 32
+#endif
+
+// command lines handled per pass, 0 for no limit
+#ifndef SCHED_CMD_BUDGET
+#define SCHED_CMD_BUDGET 16
+#endif
+
+// longest wait of received commands while frames are sent, us, 0 to not yield
+#ifndef SCHED_YIELD_US
+#define SCHED_YIELD_US 1000
+#endif
+
+// latency histogram: values below 4 us exactly, then four buckets
+// per power of two up to 2^24 us
+#define SCHED_HIST_SIZE 92
+
+typedef struct
+{
+    unsigned short rx_budget;
+    unsigned short cmd_budget;
+    unsigned short yield_us;
+} sched_config_t;
+
+typedef struct
+{
+    unsigned long samples;          // passes that found new input
+    uint32_t max;                   // longest command latency, us
+    unsigned long rx_yields;        // passes that stopped sending frames early
+    unsigned long cmd_yields;       // passes that left commands for the next one
+    unsigned long input_lost;       // command lines discarded for characters the serial port lost
+    unsigned long hist[SCHED_HIST_SIZE];
+} sched_stats_t;
+
+class UT_Device;
+
+class UT_Sched {
+public:
+    UT_Sched(UT_Device & dev);
+
+    void clear(void);
+
+    void inputArrived(uint32_t now);
+    void inputBegin(void);
+    unsigned char rxYield(unsigned short frames);
+
+    uint32_t percentile(unsigned short permille);
+    void sendStatus(void);
+
+    sched_config_t config;
+    sched_stats_t stats;
+
+private:
+    UT_Device & dev;
+
+    volatile unsigned char input_pending;
+    volatile uint32_t input_since;
+};
+
+#endif
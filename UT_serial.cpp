@@ -0,0 +1,300 @@
+/********************************************************************
+ File: UT_serial.cpp
+
+ Description:
+ This file contains the buffered serial port functions.
+
+ ********************************************************************/
+
+#include "UT_serial.h"
+#include "UT_port.h"
+
+#if (SERIAL_TXBUFFER_SIZE & (SERIAL_TXBUFFER_SIZE - 1)) || (SERIAL_TXBUFFER_SIZE > 32768)
+#error "SERIAL_TXBUFFER_SIZE must be a power of two not greater than 32768"
+#endif
+
+#if (SERIAL_RXBUFFER_SIZE & (SERIAL_RXBUFFER_SIZE - 1)) || (SERIAL_RXBUFFER_SIZE > 32768)
+#error "SERIAL_RXBUFFER_SIZE must be a power of two not greater than 32768"
+#endif
+
+#define SERIAL_TXBUFFER_MASK (SERIAL_TXBUFFER_SIZE - 1)
+#define SERIAL_RXBUFFER_MASK (SERIAL_RXBUFFER_SIZE - 1)
+
+#define UART_LSR_RDR (1 << 0)
+#define UART_LSR_THRE (1 << 5)
+#define UART_LSR_TEMT (1 << 6)
+#define UART_IER_THREIE (1 << 1)
+
+UT_RxRing::UT_RxRing(void) {
+    head = 0;
+    tail = 0;
+    gap = 0;
+}
+
+/**
+ * Append received characters (interrupt). Characters that don't fit
+ * are discarded; once there is room again a PORT_SERIAL_LOST marks the
+ * gap, so the command they belonged to is not spliced to the next one.
+ *
+ * @param data Received characters
+ * @param len Count of characters
+ * @return Count of characters appended
+ */
+unsigned short UT_RxRing::write(const char * data, unsigned short len) {
+    unsigned short pos = head;
+    unsigned short space = SERIAL_RXBUFFER_SIZE - (unsigned short) (pos - tail);
+
+    if (gap && space) {
+        buf[pos & SERIAL_RXBUFFER_MASK] = PORT_SERIAL_LOST;
+        pos++;
+        space--;
+        gap = 0;
+    }
+    if (len > space) {
+        gap = 1;
+        len = space;
+    }
+    for (unsigned short i = 0; i < len; i++) {
+        buf[pos & SERIAL_RXBUFFER_MASK] = data[i];
+        pos++;
+    }
+    __DMB();
+    head = pos;
+    return len;
+}
+
+/**
+ * Get the received characters up to the end of the ring in place.
+ * They stay queued until released with consume().
+ *
+ * @param data Set to the first character
+ * @param more Set to 1 if further characters follow at the start of the ring
+ * @return Count of contiguous characters, 0 if none is queued
+ */
+unsigned short UT_RxRing::peek(char ** data, unsigned char * more) {
+    unsigned short pos = tail;
+    unsigned short filled = head - pos;
+    __DMB();
+
+    unsigned short n = SERIAL_RXBUFFER_SIZE - (pos & SERIAL_RXBUFFER_MASK);
+    if (n > filled)
+        n = filled;
+    *data = &buf[pos & SERIAL_RXBUFFER_MASK];
+    *more = filled > n;
+    return n;
+}
+
+/**
+ * Release characters returned by peek()
+ *
+ * @param len Count of characters
+ */
+void UT_RxRing::consume(unsigned short len) {
+    __DMB();
+    tail = tail + len;
+}
+
+/**
+ * Check for received characters
+ *
+ * @return 1 if a character can be read
+ */
+int UT_RxRing::readable(void) {
+    return head != tail;
+}
+
+/**
+ * Get count of free characters
+ *
+ * @return Characters that can be appended
+ */
+unsigned short UT_RxRing::space(void) {
+    return SERIAL_RXBUFFER_SIZE - (unsigned short) (head - tail);
+}
+
+/**
+ * Get next received character. Waits if none is queued.
+ *
+ * @return Received character
+ */
+int UT_RxRing::getc(void) {
+    unsigned short pos = tail;
+    while (head == pos)
+        ;
+    __DMB();
+    char ch = buf[pos & SERIAL_RXBUFFER_MASK];
+    tail = pos + 1;
+    return (unsigned char) ch;
+}
+
+UT_Serial::UT_Serial(PinName tx, PinName rx) : Serial(tx, rx) {
+    txhead = 0;
+    txtail = 0;
+    rxcallback = NULL;
+    attach(this, &UT_Serial::txIrq, TxIrq);
+    // transmit interrupt is only enabled while data is pending
+    _serial.uart->IER &= ~UART_IER_THREIE;
+    attach(this, &UT_Serial::rxIrq, RxIrq);
+}
+
+/**
+ * Set function to call from the receive interrupt after new
+ * characters were queued
+ *
+ * @param fptr Callback, NULL to disable
+ */
+void UT_Serial::attachRx(void (*fptr)(void)) {
+    rxcallback = fptr;
+}
+
+/**
+ * Check for received characters
+ *
+ * @return 1 if a character can be read
+ */
+int UT_Serial::readable(void) {
+    return rx.readable();
+}
+
+/**
+ * Get received characters in place, see UT_RxRing::peek()
+ *
+ * @param data Set to the first character
+ * @param more Set to 1 if further characters follow at the start of the ring
+ * @return Count of contiguous characters
+ */
+unsigned short UT_Serial::peek(char ** data, unsigned char * more) {
+    return rx.peek(data, more);
+}
+
+/**
+ * Release characters returned by peek()
+ *
+ * @param len Count of characters
+ */
+void UT_Serial::consume(unsigned short len) {
+    rx.consume(len);
+}
+
+/**
+ * Get next received character. Waits if none is queued.
+ *
+ * @return Received character
+ */
+int UT_Serial::_getc(void) {
+    return rx.getc();
+}
+
+/**
+ * Receive interrupt handler.
+ * Empties the UART fifo into the receive ring. Characters that don't
+ * fit are discarded (see UT_RxRing::write()).
+ */
+void UT_Serial::rxIrq(void) {
+    char fifo[UART_FIFO_DEPTH];
+    unsigned short n = 0;
+
+    while ((_serial.uart->LSR & UART_LSR_RDR) && (n < UART_FIFO_DEPTH))
+        fifo[n++] = _serial.uart->RBR;
+    rx.write(fifo, n);
+
+    if (rxcallback)
+        rxcallback();
+}
+
+/**
+ * Queue given data for transmission.
+ * Waits for free space if the transmit ring is full.
+ *
+ * @param buf Data to send
+ * @param len Count of bytes to send
+ */
+void UT_Serial::write(const char * buf, unsigned short len) {
+    while (len) {
+        unsigned short head = txhead;
+        unsigned short space = SERIAL_TXBUFFER_SIZE - (unsigned short) (head - txtail);
+        if (space == 0) {
+            txStart();
+            continue;
+        }
+
+        // copy up to the end of the ring in one go
+        unsigned short n = SERIAL_TXBUFFER_SIZE - (head & SERIAL_TXBUFFER_MASK);
+        if (n > space)
+            n = space;
+        if (n > len)
+            n = len;
+        memcpy(&txbuf[head & SERIAL_TXBUFFER_MASK], buf, n);
+        __DMB();
+        txhead = head + n;
+
+        buf += n;
+        len -= n;
+    }
+    txStart();
+}
+
+/**
+ * Change the baud rate once all queued data has been sent, so a
+ * response queued before still goes out at the old rate.
+ * Waits until the transmitter is empty.
+ *
+ * @param baudrate New baud rate
+ */
+void UT_Serial::setBaud(int baudrate) {
+    while (txhead != txtail)
+        ;
+    while (!(_serial.uart->LSR & UART_LSR_TEMT))
+        ;
+    baud(baudrate);
+}
+
+/**
+ * Queue a single character. Used by putc, so single character output
+ * stays ordered with data queued by write.
+ *
+ * @param c Character to send
+ * @return Sent character
+ */
+int UT_Serial::_putc(int c) {
+    char ch = c;
+    write(&ch, 1);
+    return c;
+}
+
+/**
+ * Enable the transmit interrupt. If the fifo is already empty the
+ * interrupt will not fire by itself, so the first burst is written here.
+ */
+void UT_Serial::txStart(void) {
+    IRQn_Type irqn = (IRQn_Type) (UART0_IRQn + _serial.index);
+
+    NVIC_DisableIRQ(irqn);
+    if (_serial.uart->LSR & UART_LSR_THRE)
+        txIrq();
+    NVIC_EnableIRQ(irqn);
+}
+
+/**
+ * Transmit interrupt handler.
+ * Refills the empty UART fifo from the transmit ring.
+ */
+void UT_Serial::txIrq(void) {
+    unsigned short tail = txtail;
+    unsigned short filled = txhead - tail;
+
+    if (filled == 0) {
+        _serial.uart->IER &= ~UART_IER_THREIE;
+        return;
+    }
+
+    if (filled > UART_FIFO_DEPTH)
+        filled = UART_FIFO_DEPTH;
+    while (filled--) {
+        _serial.uart->THR = txbuf[tail & SERIAL_TXBUFFER_MASK];
+        tail++;
+    }
+    txtail = tail;
+
+    _serial.uart->IER |= UART_IER_THREIE;
+}
@@ -0,0 +1,86 @@
+/********************************************************************
+ File: UT_serial.h
+
+ Description:
+ This file contains the buffered serial port definitions.
+
+ ********************************************************************/
+#ifndef _UTSERIAL_
+#define _UTSERIAL_
+
+#include "mbed.h"
+
+#ifndef SERIAL_TXBUFFER_SIZE
+#define SERIAL_TXBUFFER_SIZE 256
+#endif
+
+#ifndef SERIAL_RXBUFFER_SIZE
+#define SERIAL_RXBUFFER_SIZE 256
+#endif
+
+#define UART_FIFO_DEPTH 16
+
+/**
+ * Receive ring of a transport. The receive interrupt appends, the
+ * thread reads the characters in place with peek() and releases
+ * them with consume(), so no lock is needed.
+ */
+class UT_RxRing {
+public:
+    UT_RxRing(void);
+
+    unsigned short write(const char * data, unsigned short len);
+
+    unsigned short peek(char ** data, unsigned char * more);
+    void consume(unsigned short len);
+    int readable(void);
+    unsigned short space(void);
+    int getc(void);
+
+private:
+    char buf[SERIAL_RXBUFFER_SIZE];
+    volatile unsigned short head;
+    volatile unsigned short tail;
+    unsigned char gap;  // PORT_SERIAL_LOST still to be appended
+};
+
+/**
+ * Serial port with interrupt driven transmit and receive rings.
+ * Output is queued and moved to the UART fifo in bursts of
+ * UART_FIFO_DEPTH bytes from the transmit interrupt, so writers only
+ * wait when the ring is full. Input is collected by the receive
+ * interrupt, which then calls the attached receive callback. The
+ * fifo trigger stays at mbed's one character: mbed's UART interrupt
+ * handler ignores the character timeout interrupt a higher trigger
+ * level would rely on.
+ */
+class UT_Serial : public Serial {
+public:
+    UT_Serial(PinName tx, PinName rx);
+
+    void write(const char * buf, unsigned short len);
+    void setBaud(int baudrate);
+
+    int readable(void);
+    unsigned short peek(char ** data, unsigned char * more);
+    void consume(unsigned short len);
+    void attachRx(void (*fptr)(void));
+
+protected:
+    virtual int _putc(int c);
+    virtual int _getc(void);
+
+private:
+    void txIrq(void);
+    void txStart(void);
+    void rxIrq(void);
+
+    char txbuf[SERIAL_TXBUFFER_SIZE];
+    volatile unsigned short txhead;
+    volatile unsigned short txtail;
+
+    UT_RxRing rx;
+    void (*rxcallback)(void);
+};
+
+#endif
@@ -0,0 +1,88 @@
+/********************************************************************
+ File: UT_swfilter.cpp
+
+ Description:
+ This file contains the software id filter functions.
+ Lists are changed from the thread with the CAN interrupt masked,
+ so the receive interrupt never sees a half updated range table.
+
+ ********************************************************************/
+
+#include <string.h>
+
+#include "UT_swfilter.h"
+
+#include "UT_port.h"
+
+UT_SwFilter::UT_SwFilter(void) {
+    mode = SWFILTER_OFF;
+    rejected = 0;
+    memset(stdmap, 0, sizeof(stdmap));
+    ext_count = 0;
+}
+
+/**
+ * Set filter mode
+ *
+ * @param mode SWFILTER_OFF, SWFILTER_ALLOW or SWFILTER_DENY
+ */
+void UT_SwFilter::setMode(unsigned char mode) {
+    this->mode = mode;
+}
+
+/**
+ * Add standard id range to the list or remove it
+ *
+ * @param lo First id (0..0x7FF)
+ * @param hi Last id (0..0x7FF)
+ * @param listed 1 to add, 0 to remove
+ */
+void UT_SwFilter::setStd(unsigned long lo, unsigned long hi, unsigned char listed) {
+    PORT_CAN_LOCK();
+    for (; lo <= hi; lo++) {
+        if (listed)
+            stdmap[lo >> 5] |= 1UL << (lo & 0x1F);
+        else
+            stdmap[lo >> 5] &= ~(1UL << (lo & 0x1F));
+    }
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Add extended id range to the list or remove it
+ *
+ * @param lo First id
+ * @param hi Last id
+ * @param listed 1 to add, 0 to remove
+ * @return 1 on success, 0 if the range table is full
+ */
+unsigned char UT_SwFilter::setExt(unsigned long lo, unsigned long hi, unsigned char listed) {
+    unsigned char ok;
+    PORT_CAN_LOCK();
+    if (listed)
+        ok = idrange_add(ext, &ext_count, SWFILTER_EXT_MAXRANGES, lo, hi);
+    else
+        ok = idrange_remove(ext, &ext_count, SWFILTER_EXT_MAXRANGES, lo, hi);
+    PORT_CAN_UNLOCK();
+    return ok;
+}
+
+/**
+ * Empty both lists
+ */
+void UT_SwFilter::clear(void) {
+    PORT_CAN_LOCK();
+    memset(stdmap, 0, sizeof(stdmap));
+    ext_count = 0;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Look up extended id in the range table
+ *
+ * @param id Extended identifier
+ * @return 1 if listed
+ */
+unsigned char UT_SwFilter::listedExt(unsigned long id) {
+    return idrange_contains(ext, ext_count, id);
+}
@@ -0,0 +1,76 @@
+/********************************************************************
+ File: UT_swfilter.h
+
+ Description:
+ This file contains the software id filter definitions. It runs in
+ the receive interrupt between the controller and the receive buffer
+ and complements the hardware acceptance filter with per session
+ allow/deny lists: a bitmap for standard ids, sorted ranges for
+ extended ids.
+
+ ********************************************************************/
+#ifndef _SWFILTER_
+#define _SWFILTER_
+
+#include <stdint.h>
+
+#include "UT_idrange.h"
+
+#define SWFILTER_OFF 0      // pass all frames
+#define SWFILTER_ALLOW 1    // pass listed ids only
+#define SWFILTER_DENY 2     // drop listed ids
+
+#ifndef SWFILTER_EXT_MAXRANGES
+#define SWFILTER_EXT_MAXRANGES 1024
+#endif
+
+class UT_SwFilter {
+public:
+    UT_SwFilter(void);
+
+    void setMode(unsigned char mode);
+    void setStd(unsigned long lo, unsigned long hi, unsigned char listed);
+    unsigned char setExt(unsigned long lo, unsigned long hi, unsigned char listed);
+    void clear(void);
+
+    unsigned char listedExt(unsigned long id);
+    inline unsigned char accept(unsigned long id, unsigned char extended);
+
+    volatile unsigned char mode;
+    volatile unsigned long rejected;
+
+private:
+    uint32_t stdmap[2048 / 32];
+    idrange_t ext[SWFILTER_EXT_MAXRANGES];
+    unsigned short ext_count;
+};
+
+/**
+ * Check given id against the filter (receive interrupt)
+ *
+ * @param id Identifier
+ * @param extended 1 for extended identifier
+ * @return 1 to accept the frame, 0 to drop it
+ */
+inline unsigned char UT_SwFilter::accept(unsigned long id, unsigned char extended) {
+    unsigned char current = mode;
+    unsigned char listed;
+
+    if (current == SWFILTER_OFF)
+        return 1;
+
+    if (extended) {
+        listed = listedExt(id);
+    } else {
+        id &= 0x7FF;
+        listed = (stdmap[id >> 5] >> (id & 0x1F)) & 1;
+    }
+
+    if (listed == (current == SWFILTER_ALLOW))
+        return 1;
+
+    rejected++;
+    return 0;
+}
+
+#endif
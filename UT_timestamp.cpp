@@ -0,0 +1,35 @@
+/********************************************************************
+ File: UT_timestamp.cpp
+
+ Description:
+ This file contains the receive timestamp functions.
+
+ The millisecond timestamp is accumulated from microsecond deltas,
+ so it stays continuous when the 32-bit microsecond counter wraps
+ (every 71.6 minutes, which is not a multiple of 60 s). Besides the
+ receive interrupt, the main loop advances it at least every
+ UT_IDLE_TIMEOUT ms, so no delta spans a whole wrap on a quiet bus.
+
+ ********************************************************************/
+
+#include "UT_timestamp.h"
+
+UT_Timestamp::UT_Timestamp(unsigned char available) : available(available) {
+    mode = TIMESTAMP_OFF;
+    last_us = 0;
+    us_rem = 0;
+    ms = 0;
+}
+
+/**
+ * Advance the millisecond clock to given time. The thread calls it
+ * with the CAN interrupt masked.
+ *
+ * @param now Current clock microseconds
+ */
+void UT_Timestamp::advance(uint32_t now) {
+    us_rem += (uint32_t) (now - last_us);
+    last_us = now;
+    ms = (ms + us_rem / 1000) % TIMESTAMP_MS_WRAP;
+    us_rem %= 1000;
+}
@@ -0,0 +1,84 @@
+/********************************************************************
+ File: UT_timestamp.h
+
+ Description:
+ This file contains the receive timestamp definitions. Timestamps
+ are taken in the receive interrupt from the free running 1 MHz
+ clock of the port (us_ticker on the device). Buffered frames keep
+ only the low CANMSG_TIMESTAMP_BITS bits, the encoders restore the
+ rest.
+
+ ********************************************************************/
+#ifndef _TIMESTAMP_
+#define _TIMESTAMP_
+
+#include <stdint.h>
+
+#include "UT_CANMessage.h"
+
+#define TIMESTAMP_OFF 0
+#define TIMESTAMP_MS 1      // 16-bit milliseconds, wrapping at 60000
+#define TIMESTAMP_US 2      // 32-bit microseconds
+
+#define TIMESTAMP_MS_WRAP 60000
+
+// default of UT_DefaultConfig::timestamps; 0 compiles time stamping
+// out: 'Z' only accepts 0 and the engine drops the timestamp branches
+// of the receive path and the encoders
+#ifndef USBTIN_TIMESTAMPS
+#define USBTIN_TIMESTAMPS 1
+#endif
+
+class UT_Timestamp {
+public:
+    UT_Timestamp(unsigned char available);
+
+    void advance(uint32_t now);
+    inline unsigned long capture(uint32_t now);
+    inline unsigned long expand(unsigned long stored, uint32_t now);
+
+    unsigned char mode;             // TIMESTAMP_*
+    const unsigned char available;  // 0 if the engine was built without
+
+private:
+    uint32_t last_us;
+    unsigned long us_rem;
+    unsigned long ms;
+};
+
+/**
+ * Get timestamp for a frame received now, in the format selected by
+ * mode. Must only be called from the receive interrupt.
+ *
+ * @param now Current clock microseconds
+ * @return Timestamp, 0 if time stamping is off
+ */
+inline unsigned long UT_Timestamp::capture(uint32_t now) {
+    advance(now);
+
+    switch (mode) {
+        case TIMESTAMP_MS:
+            return ms;
+        case TIMESTAMP_US:
+            return now;
+    }
+    return 0;
+}
+
+/**
+ * Restore the timestamp of a buffered frame for sending. Millisecond
+ * timestamps fit into the frame, microsecond timestamps get their upper
+ * bits from the current time. This is exact while frames are sent
+ * within 2^CANMSG_TIMESTAMP_BITS us (268 s) of their reception.
+ *
+ * @param stored Timestamp as kept in the frame
+ * @param now Current clock microseconds
+ * @return Timestamp in the format selected by mode
+ */
+inline unsigned long UT_Timestamp::expand(unsigned long stored, uint32_t now) {
+    if (mode != TIMESTAMP_US)
+        return stored;
+    return now - ((now - stored) & CANMSG_TIMESTAMP_MASK);
+}
+
+#endif
@@ -0,0 +1,38 @@
+/********************************************************************
+ File: UT_txbuffer.cpp
+
+ Description:
+ This file contains the serial output batching buffer functions.
+
+ ********************************************************************/
+
+#include "UT_txbuffer.h"
+
+#include "UT_core.h"
+
+UT_TxBuffer::UT_TxBuffer(UT_Device & dev, char * buf, unsigned short size)
+        : dev(dev), buf(buf), size(size) {
+    filled = 0;
+}
+
+/**
+ * Append a single character
+ *
+ * @param ch Character to send
+ */
+void UT_TxBuffer::putc(char ch) {
+    *reserve(1) = ch;
+    commit(1);
+}
+
+/**
+ * Hand all pending data to the serial port in one write
+ */
+void UT_TxBuffer::flush(void) {
+    if (filled == 0)
+        return;
+    PERF_BEGIN(start);
+    dev.serialWrite(buf, filled);
+    filled = 0;
+    PERF_END(dev.perf, PERF_FLUSH, start);
+}
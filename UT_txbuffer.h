@@ -0,0 +1,59 @@
+/********************************************************************
+ File: UT_txbuffer.h
+
+ Description:
+ This file contains the serial output batching buffer definitions.
+ Received frames and command responses are assembled here and
+ handed to the serial port in one write per main loop pass.
+
+ ********************************************************************/
+#ifndef _TXBUFFER_
+#define _TXBUFFER_
+
+// default of UT_DefaultConfig::txBufferSize
+#ifndef TXBUFFER_SIZE
+#define TXBUFFER_SIZE 128
+#endif
+
+class UT_Device;
+
+class UT_TxBuffer {
+public:
+    UT_TxBuffer(UT_Device & dev, char * buf, unsigned short size);
+
+    inline char * reserve(unsigned char len);
+    inline void commit(unsigned char len);
+    void putc(char ch);
+    void flush(void);
+
+private:
+    UT_Device & dev;
+
+    char * const buf;
+    const unsigned short size;
+    unsigned short filled;
+};
+
+/**
+ * Reserve contiguous space at the end of the buffer.
+ * Pending data is flushed first if the space is not available.
+ *
+ * @param len Count of bytes to reserve, at most the buffer size
+ * @return Pointer to reserved space
+ */
+inline char * UT_TxBuffer::reserve(unsigned char len) {
+    if (filled + len > size)
+        flush();
+    return &buf[filled];
+}
+
+/**
+ * Append the bytes written to the reserved space
+ *
+ * @param len Count of bytes actually written
+ */
+inline void UT_TxBuffer::commit(unsigned char len) {
+    filled += len;
+}
+
+#endif
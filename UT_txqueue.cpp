@@ -0,0 +1,144 @@
+/********************************************************************
+ File: UT_txqueue.cpp
+
+ Description:
+ This file contains the CAN transmit queue functions. There is one
+ queue per channel. Queued frames are handed to the port whenever a
+ hardware transmit buffer is free, the port keeps them in order.
+
+ Frames are queued by the thread and, for gateway routes, by the CAN
+ receive interrupt. Both controllers share one interrupt, so the
+ thread side masks it while queueing.
+
+ ********************************************************************/
+
+#include "UT_txqueue.h"
+
+#include "UT_core.h"
+
+#if (TXQUEUE_SIZE & (TXQUEUE_SIZE - 1)) || (TXQUEUE_SIZE > 32768)
+#error "TXQUEUE_SIZE must be a power of two not greater than 32768"
+#endif
+
+#define TXQUEUE_MASK (TXQUEUE_SIZE - 1)
+
+UT_TxQueue::UT_TxQueue(UT_Device & dev) : dev(dev) {
+    unsigned char channel;
+
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        txring[channel].putpos = 0;
+        txring[channel].getpos = 0;
+    }
+}
+
+/**
+ * Empty the queue. Called whenever the channel is opened.
+ *
+ * @param channel Channel index
+ */
+void UT_TxQueue::init(unsigned char channel) {
+    clear(channel);
+}
+
+/**
+ * Drop all queued frames
+ *
+ * @param channel Channel index
+ */
+void UT_TxQueue::clear(unsigned char channel) {
+    PORT_CAN_LOCK();
+    txring[channel].getpos = txring[channel].putpos;
+    PORT_CAN_UNLOCK();
+}
+
+/**
+ * Move queued frames of given channel into free hardware transmit buffers
+ *
+ * @param channel Channel index
+ */
+void UT_TxQueue::drain(unsigned char channel) {
+    txring_t * ring = &txring[channel];
+    unsigned short getpos = ring->getpos;
+
+    while (getpos != ring->putpos) {
+        PERF_BEGIN(start);
+        if (!dev.canSendFromIsr(channel, &ring->queue[getpos & TXQUEUE_MASK]))
+            break;
+        PERF_END(dev.perf, PERF_CANTX, start);
+        PERF_COUNT(dev.perf, channel, tx);
+        if (dev.busstats.enabled)
+            dev.busstats.transmit(channel, &ring->queue[getpos & TXQUEUE_MASK]);
+        getpos++;
+    }
+
+    ring->getpos = getpos;
+}
+
+/**
+ * CAN transmit interrupt handler, serves all channels
+ */
+void UT_TxQueue::isr(void) {
+    unsigned char channel;
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++)
+        drain(channel);
+}
+
+/**
+ * Queue given frame for transmission from the CAN interrupt
+ *
+ * @param channel Channel index
+ * @param canmsg Frame to send
+ * @return 1 if queued, 0 if the queue is full
+ */
+unsigned char UT_TxQueue::putFromIsr(unsigned char channel, canmsg_t * canmsg) {
+    txring_t * ring = &txring[channel];
+    unsigned short putpos = ring->putpos;
+    unsigned short filled = putpos - ring->getpos;
+    if (filled >= TXQUEUE_SIZE) {
+        PERF_COUNT(dev.perf, channel, dropped_txfull);
+        return 0;
+    }
+
+    ring->queue[putpos & TXQUEUE_MASK] = *canmsg;
+    ring->putpos = putpos + 1;
+    PERF_HIGHWATER(dev.perf, channel, tx_highwater, filled + 1);
+
+    // start transmission if the controller is idle
+    drain(channel);
+
+    return 1;
+}
+
+/**
+ * Queue given frame for transmission (thread side)
+ *
+ * @param channel Channel index
+ * @param canmsg Frame to send
+ * @return 1 if queued, 0 if the queue is full
+ */
+unsigned char UT_TxQueue::put(unsigned char channel, canmsg_t * canmsg) {
+    PORT_CAN_LOCK();
+    unsigned char result = putFromIsr(channel, canmsg);
+    PORT_CAN_UNLOCK();
+    return result;
+}
+
+/**
+ * Get count of free queue slots
+ *
+ * @param channel Channel index
+ * @return Free slots
+ */
+unsigned short UT_TxQueue::free(unsigned char channel) {
+    return TXQUEUE_SIZE - (unsigned short) (txring[channel].putpos - txring[channel].getpos);
+}
+
+/**
+ * Check if the queue is filled above TXQUEUE_HIGHWATER
+ *
+ * @param channel Channel index
+ * @return 1 if the host should slow down
+ */
+unsigned char UT_TxQueue::nearlyFull(unsigned char channel) {
+    return (unsigned short) (txring[channel].putpos - txring[channel].getpos) >= TXQUEUE_HIGHWATER;
+}
@@ -0,0 +1,58 @@
+/********************************************************************
+ File: UT_txqueue.h
+
+ Description:
+ This file contains the CAN transmit queue definitions. Frames are
+ queued per channel by the command parser or the gateway and loaded
+ into the three hardware transmit buffers of the channel's controller
+ from the CAN transmit interrupt.
+
+ ********************************************************************/
+#ifndef _TXQUEUE_
+#define _TXQUEUE_
+
+#include "UT_config.h"
+#include "UT_CANMessage.h"
+
+#ifndef TXQUEUE_SIZE
+#define TXQUEUE_SIZE 32
+#endif
+
+// fill level from which the host is asked to slow down
+#ifndef TXQUEUE_HIGHWATER
+#define TXQUEUE_HIGHWATER (TXQUEUE_SIZE * 3 / 4)
+#endif
+
+typedef struct
+{
+    canmsg_t queue[TXQUEUE_SIZE];
+    volatile unsigned short putpos;
+    volatile unsigned short getpos;
+} txring_t;
+
+class UT_Device;
+
+class UT_TxQueue {
+public:
+    UT_TxQueue(UT_Device & dev);
+
+    void init(unsigned char channel);
+    void clear(unsigned char channel);
+
+    unsigned char put(unsigned char channel, canmsg_t * canmsg);
+    unsigned char putFromIsr(unsigned char channel, canmsg_t * canmsg);
+
+    unsigned short free(unsigned char channel);
+    unsigned char nearlyFull(unsigned char channel);
+
+    void isr(void);
+
+private:
+    void drain(unsigned char channel);
+
+    UT_Device & dev;
+
+    txring_t txring[USBTIN_CHANNELS];
+};
+
+#endif
@@ -0,0 +1,137 @@
+/********************************************************************
+ File: UT_usbserial.cpp
+
+ Description:
+ This file contains the USB CDC transport functions. Only built with
+ USBTIN_TRANSPORT set to TRANSPORT_USBCDC, which needs the mbed
+ USBDevice library.
+
+ ********************************************************************/
+
+#include "USBtin.h"
+
+#if (USBTIN_TRANSPORT == TRANSPORT_USBCDC)
+
+/**
+ * Start the USB device without waiting for the host, so the engine
+ * runs (and the CAN side keeps working) while no host is attached
+ */
+UT_USBSerial::UT_USBSerial(void) : USBSerial(USBTIN_USB_VID, USBTIN_USB_PID, 0x0001, false) {
+    rxstalled = 0;
+    rxcallback = NULL;
+}
+
+/**
+ * Send given data in bulk packets. Waits until each packet has been
+ * taken by the host; without a configured host the data is dropped.
+ *
+ * @param buf Data to send
+ * @param len Count of bytes to send
+ */
+void UT_USBSerial::write(const char * buf, unsigned short len) {
+    while (len && configured()) {
+        unsigned short n = (len > USB_BULK_PACKET) ? USB_BULK_PACKET : len;
+        if (!writeBlock((uint8_t *) buf, n))
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+/**
+ * A CDC device has no baud rate, the host's line coding is ignored
+ *
+ * @param baudrate Ignored
+ */
+void UT_USBSerial::setBaud(int baudrate) {
+}
+
+/**
+ * Check for received characters
+ *
+ * @return 1 if a character can be read
+ */
+int UT_USBSerial::readable(void) {
+    return rx.readable();
+}
+
+/**
+ * Get received characters in place, see UT_RxRing::peek()
+ *
+ * @param data Set to the first character
+ * @param more Set to 1 if further characters follow at the start of the ring
+ * @return Count of contiguous characters
+ */
+unsigned short UT_USBSerial::peek(char ** data, unsigned char * more) {
+    return rx.peek(data, more);
+}
+
+/**
+ * Release characters returned by peek()
+ *
+ * @param len Count of characters
+ */
+void UT_USBSerial::consume(unsigned short len) {
+    rx.consume(len);
+    rearm();
+}
+
+/**
+ * Get next received character. Waits if none is queued.
+ *
+ * @return Received character
+ */
+int UT_USBSerial::_getc(void) {
+    int c = rx.getc();
+    rearm();
+    return c;
+}
+
+/**
+ * Arm the bulk out endpoint again if the USB interrupt left it
+ * stopped and the ring now has room for a full packet (thread)
+ */
+void UT_USBSerial::rearm(void) {
+    if (!rxstalled || (rx.space() < USB_BULK_PACKET))
+        return;
+    NVIC_DisableIRQ(USB_IRQn);
+    rxstalled = 0;
+    readStart(EPBULK_OUT, USB_BULK_PACKET);
+    NVIC_EnableIRQ(USB_IRQn);
+}
+
+/**
+ * Set function to call from the USB interrupt after new characters
+ * were received
+ *
+ * @param fptr Callback, NULL to disable
+ */
+void UT_USBSerial::attachRx(void (*fptr)(void)) {
+    rxcallback = fptr;
+}
+
+/**
+ * Bulk out interrupt handler. Copies the received packet into the
+ * receive ring instead of the library's character buffer. The
+ * endpoint is armed for the next packet only if that fits, otherwise
+ * consume() arms it once the thread has made room.
+ *
+ * @return true
+ */
+bool UT_USBSerial::EPBULK_OUT_callback(void) {
+    uint8_t packet[USB_BULK_PACKET];
+    uint32_t size = 0;
+
+    USBDevice::readEP(EPBULK_OUT, packet, &size, USB_BULK_PACKET);
+    rx.write((const char *) packet, size);
+    if (rx.space() >= USB_BULK_PACKET)
+        readStart(EPBULK_OUT, USB_BULK_PACKET);
+    else
+        rxstalled = 1;
+
+    if (rxcallback)
+        rxcallback();
+    return true;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/********************************************************************
+ File: UT_usbserial.h
+
+ Description:
+ This file contains the USB CDC transport definitions. It uses the
+ full-speed USB device of the LPC1768 (mbed USBDevice library)
+ instead of a UART, so the link is not limited by a baud rate.
+
+ ********************************************************************/
+#ifndef _UTUSBSERIAL_
+#define _UTUSBSERIAL_
+
+#include "mbed.h"
+#include "USBSerial.h"
+#include "UT_serial.h"
+
+// USB ids of the USBtin, so host software finds the device
+#ifndef USBTIN_USB_VID
+#define USBTIN_USB_VID 0x04D8
+#endif
+
+#ifndef USBTIN_USB_PID
+#define USBTIN_USB_PID 0x000A
+#endif
+
+// bulk endpoint packet size of a full-speed CDC device
+#define USB_BULK_PACKET 64
+
+/**
+ * Virtual serial port on the LPC1768's own USB device with the
+ * interface of UT_Serial. Output is sent in 64-byte bulk packets,
+ * input is copied from each received bulk packet into the receive
+ * ring in the USB interrupt, which then calls the attached receive
+ * callback. The bulk out endpoint is only armed again while the ring
+ * has room for a full packet, so the host waits instead of losing
+ * characters.
+ */
+class UT_USBSerial : public USBSerial {
+public:
+    UT_USBSerial(void);
+
+    void write(const char * buf, unsigned short len);
+    void setBaud(int baudrate);
+
+    int readable(void);
+    unsigned short peek(char ** data, unsigned char * more);
+    void consume(unsigned short len);
+    void attachRx(void (*fptr)(void));
+
+protected:
+    virtual bool EPBULK_OUT_callback(void);
+    virtual int _getc(void);
+
+private:
+    void rearm(void);
+
+    UT_RxRing rx;
+    volatile unsigned char rxstalled;
+    void (*rxcallback)(void);
+};
+
+#endif
@@ -0,0 +1,970 @@
+/********************************************************************
+ File: UT_sim.cpp
+
+ Description:
+ This file contains the simulator event loop and the ports of the
+ engine instance of the host build. Time is kept in nanoseconds internally, so byte
+ and bit times of common rates don't accumulate rounding errors.
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "UT_sim.h"
+
+#include "UT_hex.h"
+
+#define NO_EVENT UINT64_MAX
+#define TX_BUFFERS 3
+
+typedef struct
+{
+    unsigned long bitrate;
+    unsigned char open;
+    unsigned char listen;
+
+    // frame on the bus
+    unsigned char busy;
+    unsigned char busy_tx;
+    canmsg_t busy_msg;
+    uint64_t busy_end;
+
+    // hardware transmit buffers, sent in load order
+    canmsg_t tx[TX_BUFFERS];
+    unsigned char tx_count;
+} simchannel_t;
+
+uint64_t sim_now = 0;
+sim_stats_t sim_stats;
+
+static UT_SimCan sim_can;
+static UT_SimSerial sim_serial;
+static UT_SimClock sim_clock;
+static device_bulk0_t sim_bulk0;
+static device_bulk1_t sim_bulk1;
+
+UT_SimEngine sim_device(sim_can, sim_serial, sim_clock, sim_bulk0, sim_bulk1);
+
+static uint64_t now_ns = 0;
+static uint64_t byte_ns;
+static uint64_t cutoff_ns = NO_EVENT;
+static uint64_t tick_last = 0;
+static uint64_t timer_ns = NO_EVENT;
+static uint64_t poll_ns = 0;
+static uint64_t poll_next = 0;
+static unsigned char crosswire = 0;
+
+static simchannel_t channels[USBTIN_CHANNELS];
+
+static sim_source_t * sources[SIM_MAXSOURCES];
+static sim_frame_t source_head[SIM_MAXSOURCES];
+static uint64_t source_base[SIM_MAXSOURCES];
+static unsigned char source_valid[SIM_MAXSOURCES];
+static unsigned char source_count = 0;
+
+// device -> host
+static unsigned char txbuf[SIM_SERIAL_TXBUFFER];
+static unsigned short txhead = 0, txcount = 0;
+static uint64_t tx_next;
+
+// host -> device
+static char * hostbuf = NULL;
+static size_t hostlen = 0, hostpos = 0;
+static uint64_t rx_next;
+static char rxbuf[SIM_SERIAL_RXBUFFER];
+static unsigned short rxhead = 0, rxcount = 0;
+static unsigned char rxgap = 0;
+
+// acceptance filter
+static idrange_t * filter_std = NULL;
+static unsigned short filter_std_count = 0;
+static idrange_t * filter_ext = NULL;
+static unsigned short filter_ext_count = 0;
+static unsigned char filter_all = 1;
+
+// host side decoder
+static unsigned char hostbinary = 0;
+static unsigned char hostline[256];
+static unsigned short hostline_len = 0;
+static unsigned long hostline_total = 0;
+static uint32_t * latency = NULL;
+static unsigned long latency_count = 0, latency_size = 0;
+
+// host side transmit stream
+static unsigned long hosttx_remaining = 0;
+static unsigned long hosttx_seq = 0;
+static unsigned char hosttx_outstanding = 0;
+static unsigned char hosttx_window = 0;
+
+// host side trace upload for the replay mode
+static sim_source_t * upload_src = NULL;
+static uint64_t upload_until;
+static sim_frame_t upload_frame;
+static unsigned char upload_valid = 0;
+static unsigned char upload_outstanding = 0;
+static unsigned char upload_started = 0;
+static unsigned char upload_ended = 0;
+static unsigned long upload_acked = 0;
+
+// engine cpu time measurement
+static unsigned char cpu_depth = 0;
+static struct timespec cpu_start;
+
+/**
+ * Start measuring engine cpu time, calls may nest
+ */
+static void cpuEnter(void) {
+    if (cpu_depth++ == 0)
+        clock_gettime(CLOCK_MONOTONIC, &cpu_start);
+}
+
+/**
+ * Stop measuring engine cpu time
+ */
+static void cpuLeave(void) {
+    if (--cpu_depth == 0) {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        sim_stats.cpu_ns += (end.tv_sec - cpu_start.tv_sec) * 1000000000ULL
+            + end.tv_nsec - cpu_start.tv_nsec;
+    }
+}
+
+/**
+ * Set up the simulator
+ *
+ * @param baud Serial link bit rate
+ */
+void sim_init(unsigned long baud) {
+    unsigned char channel;
+
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    byte_ns = 10000000000ULL / baud;
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        memset(&channels[channel], 0, sizeof(channels[channel]));
+        channels[channel].bitrate = 500000;
+    }
+}
+
+/**
+ * Fetch next frame of given source, relative to the time it was added
+ *
+ * @param i Source index
+ */
+static void fetchSource(unsigned char i) {
+    source_valid[i] = simsource_next(sources[i], &source_head[i]);
+    source_head[i].time += source_base[i];
+}
+
+/**
+ * Register traffic source. Its frame times count from now.
+ *
+ * @param src Parsed source
+ * @return 1 on success, 0 if the source table is full
+ */
+unsigned char sim_addSource(sim_source_t * src) {
+    if (source_count >= SIM_MAXSOURCES)
+        return 0;
+    sources[source_count] = src;
+    source_base[source_count] = sim_now;
+    fetchSource(source_count);
+    source_count++;
+    return 1;
+}
+
+/**
+ * Queue characters from the host to the device
+ *
+ * @param buf Zero terminated characters
+ */
+void sim_hostSend(const char * buf) {
+    size_t len = strlen(buf);
+    if (hostpos == hostlen)
+        rx_next = now_ns + byte_ns;
+    hostbuf = (char *) realloc(hostbuf, hostlen + len);
+    memcpy(hostbuf + hostlen, buf, len);
+    hostlen += len;
+}
+
+/**
+ * Wire the buses of both channels to each other's receiver
+ *
+ * @param on 1 to connect
+ */
+void sim_crosswire(unsigned char on) {
+    crosswire = on;
+}
+
+/**
+ * Run the engine thread at most once per period instead of at once
+ * when signalled, like a main loop ending each pass with a fixed sleep
+ *
+ * @param period_us Period, 0 to run on each signal
+ */
+void sim_poll(uint32_t period_us) {
+    poll_ns = period_us * 1000ULL;
+}
+
+/**
+ * Switch the host side decoder to binary framing. Call once the
+ * response to 'B1' arrived and before frames are flowing.
+ */
+void sim_hostBinary(void) {
+    hostbinary = 1;
+    hostline_len = 0;
+}
+
+/**
+ * Send transmit commands until the window of unanswered commands is full
+ */
+static void hostTransmitFill(void) {
+    char cmd[32];
+
+    while ((hosttx_remaining > 0) && (hosttx_outstanding < hosttx_window)) {
+        snprintf(cmd, sizeof(cmd), "t2008%08lX%08lX\r", hosttx_seq, hosttx_seq);
+        sim_hostSend(cmd);
+        hosttx_seq++;
+        hosttx_remaining--;
+        hosttx_outstanding++;
+    }
+}
+
+/**
+ * Start streaming transmit commands on channel 0
+ *
+ * @param count Count of frames to send
+ * @param window Count of commands sent ahead of their responses
+ */
+void sim_hostTransmit(unsigned long count, unsigned char window) {
+    hosttx_remaining = count;
+    hosttx_window = window;
+    sim_stats.tx_start = sim_now;
+    hostTransmitFill();
+}
+
+/**
+ * Host side: response to a transmit command arrived
+ *
+ * @param accepted 1 if acknowledged, 0 if rejected
+ */
+static void hostTransmitResponse(unsigned char accepted) {
+    if (hosttx_outstanding == 0)
+        return;
+    hosttx_outstanding--;
+    if (accepted) {
+        sim_stats.tx_acked++;
+        sim_stats.tx_end = now_ns / 1000;
+    } else {
+        sim_stats.tx_rejected++;
+        hosttx_remaining++;
+    }
+    hostTransmitFill();
+}
+
+/**
+ * Send the next replay command. Frames are sent one at a time and
+ * resent while the device rejects them; the replay is started once
+ * half of the staging ring is filled or the trace is loaded.
+ */
+static void hostReplayFill(void) {
+    char cmd[48];
+
+    if ((upload_src == NULL) || upload_outstanding || upload_ended)
+        return;
+
+    if (!upload_valid) {
+        upload_valid = simsource_next(upload_src, &upload_frame)
+            && (upload_frame.time < upload_until) && (upload_frame.channel < USBTIN_CHANNELS);
+    }
+
+    if (!upload_started && (!upload_valid || (upload_acked >= REPLAY_BUFFERSIZE / 2))) {
+        sim_hostSend("ps\r");
+        upload_started = 1;
+    } else if (upload_valid) {
+        canmsg_t * msg = &upload_frame.msg;
+        char * p = cmd;
+        unsigned char i;
+        if (upload_frame.channel != 0)
+            p += sprintf(p, "%u", upload_frame.channel);
+        p += sprintf(p, "pf%08lX", (unsigned long) upload_frame.time);
+        if (msg->extended)
+            p += sprintf(p, "%c%08lX%X", msg->rtr ? 'R' : 'T', (unsigned long) msg->id, (unsigned) msg->dlc);
+        else
+            p += sprintf(p, "%c%03lX%X", msg->rtr ? 'r' : 't', (unsigned long) msg->id, (unsigned) msg->dlc);
+        for (i = 0; !msg->rtr && (i < msg->dlc) && (i < 8); i++)
+            p += sprintf(p, "%02X", msg->data[i]);
+        sprintf(p, "\r");
+        sim_hostSend(cmd);
+    } else {
+        sim_hostSend("pe\r");
+        upload_ended = 1;
+    }
+    upload_outstanding = 1;
+}
+
+/**
+ * Start uploading given source to the device's replay ring. Frame
+ * times become the replay offsets. Must not be combined with
+ * sim_hostTransmit() or other commands awaiting a response.
+ *
+ * @param src Source of the trace
+ * @param until Frames at or after this time (us) are left out
+ */
+void sim_hostReplay(sim_source_t * src, uint64_t until) {
+    upload_src = src;
+    upload_until = until;
+    sim_stats.replay_start = sim_now;
+    hostReplayFill();
+}
+
+/**
+ * Host side: response to a replay command arrived
+ *
+ * @param accepted 1 if acknowledged, 0 if rejected
+ */
+static void hostReplayResponse(unsigned char accepted) {
+    if (!upload_outstanding)
+        return;
+    upload_outstanding = 0;
+    if (accepted && upload_valid) {
+        upload_valid = 0;
+        upload_acked++;
+    }
+    hostReplayFill();
+}
+
+/**
+ * Store a latency sample
+ *
+ * @param us Latency in microseconds
+ */
+static void addLatency(uint32_t us) {
+    if (latency_count == latency_size) {
+        latency_size = latency_size ? 2 * latency_size : 4096;
+        latency = (uint32_t *) realloc(latency, latency_size * sizeof(uint32_t));
+    }
+    latency[latency_count++] = us;
+}
+
+/**
+ * Get collected latency samples
+ *
+ * @param samples Output pointer to samples
+ * @return Count of samples
+ */
+unsigned long sim_latencies(uint32_t ** samples) {
+    *samples = latency;
+    return latency_count;
+}
+
+/**
+ * Account a frame decoded by the host
+ *
+ * @param timestamp Frame timestamp as sent by the device
+ */
+static void hostFrame(uint32_t timestamp) {
+    sim_stats.received++;
+    if (sim_device.timestamp.mode == TIMESTAMP_US)
+        addLatency((uint32_t) (now_ns / 1000) - timestamp);
+}
+
+/**
+ * Decode one ascii line sent by the device
+ */
+static void hostAsciiLine(void) {
+    unsigned char * p = hostline;
+    unsigned short len = hostline_len;
+
+    if ((len == 1) && ((*p == 'z') || (*p == 'Z') || (*p == 'y') || (*p == 'Y'))) {
+        hostTransmitResponse(1);
+        return;
+    }
+
+    if (len == 0) {
+        hostReplayResponse(1);
+        return;
+    }
+    if ((len == 54) && (*p == 'p')) {
+        hex_decode((char *) &p[6], 8, &sim_stats.replay_sent);
+        hex_decode((char *) &p[22], 8, &sim_stats.replay_underruns);
+        hex_decode((char *) &p[30], 8, &sim_stats.replay_late_min);
+        hex_decode((char *) &p[38], 8, &sim_stats.replay_late_mean);
+        hex_decode((char *) &p[46], 8, &sim_stats.replay_late_max);
+        sim_stats.replay_end = now_ns / 1000;
+        return;
+    }
+
+    if ((len > 0) && (*p == 'X')) {
+        sim_stats.isotp_pdus++;
+        sim_stats.isotp_bytes += (hostline_total - 2) / 2;
+        sim_stats.isotp_end = now_ns / 1000;
+        return;
+    }
+    if ((len == 4) && (*p == 'x')) {
+        if ((p[2] == '0') && (p[3] == '0'))
+            sim_stats.isotp_sent++;
+        else
+            sim_stats.errors++;
+        sim_stats.isotp_end = now_ns / 1000;
+        return;
+    }
+
+    if ((len > 0) && (*p >= '0') && (*p <= '9')) {
+        p++;
+        len--;
+    }
+    if ((len == 0) || ((*p != 't') && (*p != 'T') && (*p != 'r') && (*p != 'R')))
+        return;
+
+    unsigned long timestamp = 0;
+    if ((sim_device.timestamp.mode == TIMESTAMP_US) && (len >= 8))
+        hex_decode((char *) &p[len - 8], 8, &timestamp);
+    hostFrame(timestamp);
+}
+
+/**
+ * Decode one COBS encoded packet sent by the device
+ */
+static void hostBinaryPacket(void) {
+    unsigned char packet[sizeof(hostline)];
+    unsigned short len = 0, i = 0;
+
+    // COBS decode
+    while (i < hostline_len) {
+        unsigned char code = hostline[i++];
+        unsigned char n;
+        for (n = 1; (n < code) && (i < hostline_len); n++)
+            packet[len++] = hostline[i++];
+        if ((code != 0xFF) && (i < hostline_len))
+            packet[len++] = 0;
+    }
+    if ((len < 4) || (packet[1] != len - 4))
+        return;
+
+    if (packet[0] == BIN_TYPE_STATUS) {
+        if (packet[3] != BIN_ERROR_NONE)
+            sim_stats.errors++;
+        return;
+    }
+    if (packet[0] != BIN_TYPE_RX)
+        return;
+
+    unsigned char * p = &packet[2];
+    unsigned char * end = p + packet[1];
+    while (p < end) {
+        unsigned char hdr = *p++;
+        unsigned char length = hdr & BIN_HDR_DLC;
+        if (length > 8)
+            length = 8;
+        if (hdr & BIN_HDR_RTR)
+            length = 0;
+        p += ((hdr & BIN_HDR_EXT) ? 4 : 2) + length;
+
+        uint32_t timestamp = 0;
+        if (sim_device.timestamp.mode == TIMESTAMP_MS) {
+            p += 2;
+        } else if (sim_device.timestamp.mode == TIMESTAMP_US) {
+            timestamp = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+            p += 4;
+        }
+        hostFrame(timestamp);
+    }
+}
+
+/**
+ * Host side: one byte arrived from the device
+ *
+ * @param ch Received byte
+ */
+static void hostReceive(unsigned char ch) {
+    sim_stats.serial_bytes++;
+
+    if (hostbinary) {
+        if (ch == 0) {
+            hostBinaryPacket();
+            hostline_len = 0;
+        } else if (hostline_len < sizeof(hostline)) {
+            hostline[hostline_len++] = ch;
+        }
+        return;
+    }
+
+    if (ch == BELL) {
+        sim_stats.errors++;
+        hostTransmitResponse(0);
+        hostReplayResponse(0);
+    } else if (ch == CR) {
+        hostAsciiLine();
+        hostline_len = 0;
+        hostline_total = 0;
+    } else {
+        // long lines (ISO-TP PDUs) are only counted
+        if (hostline_len < sizeof(hostline))
+            hostline[hostline_len++] = ch;
+        hostline_total++;
+    }
+}
+
+/**
+ * Check given frame against the acceptance filter
+ *
+ * @param msg Frame
+ * @return 1 if accepted
+ */
+static unsigned char filterAccept(canmsg_t * msg) {
+    if (filter_all)
+        return 1;
+    if (msg->extended)
+        return idrange_contains(filter_ext, filter_ext_count, msg->id);
+    return idrange_contains(filter_std, filter_std_count, msg->id);
+}
+
+/**
+ * Get index of the source with the earliest pending frame on given channel
+ *
+ * @param channel Channel index
+ * @return Source index, -1 if none
+ */
+static int nextSource(unsigned char channel) {
+    int best = -1;
+    unsigned char i;
+    for (i = 0; i < source_count; i++) {
+        if (!source_valid[i] || (source_head[i].channel != channel))
+            continue;
+        if ((best < 0) || (source_head[i].time < source_head[best].time))
+            best = i;
+    }
+    if ((best >= 0) && (source_head[best].time * 1000 > cutoff_ns))
+        return -1;
+    return best;
+}
+
+/**
+ * Put next frame on the bus of given channel if one is ready.
+ * Of a device frame and a source frame the lower id wins arbitration.
+ *
+ * @param channel Channel index
+ */
+static void busStart(unsigned char channel) {
+    simchannel_t * chan = &channels[channel];
+    int src = nextSource(channel);
+    unsigned char rx_ready = (src >= 0) && (source_head[src].time * 1000 <= now_ns);
+
+    if (chan->busy || (!rx_ready && (chan->tx_count == 0)))
+        return;
+
+    if ((chan->tx_count > 0) && (!rx_ready || (chan->tx[0].id <= source_head[src].msg.id))) {
+        chan->busy_tx = 1;
+        chan->busy_msg = chan->tx[0];
+        chan->tx_count--;
+        memmove(&chan->tx[0], &chan->tx[1], chan->tx_count * sizeof(canmsg_t));
+    } else {
+        chan->busy_tx = 0;
+        chan->busy_msg = source_head[src].msg;
+        fetchSource(src);
+        sim_stats.offered[channel]++;
+    }
+
+    uint64_t duration = simsource_frameBits(&chan->busy_msg) * 1000000000ULL / chan->bitrate;
+    chan->busy = 1;
+    chan->busy_end = now_ns + duration;
+    sim_stats.busy_us[channel] += duration / 1000;
+}
+
+/**
+ * Receive frame on given channel, if open and accepted by the filter
+ *
+ * @param channel Channel index
+ * @param msg Frame
+ */
+static void receiveFrame(unsigned char channel, canmsg_t * msg) {
+    if (!channels[channel].open)
+        return;
+    if (!filterAccept(msg)) {
+        sim_stats.hwfiltered[channel]++;
+        return;
+    }
+
+    // receive interrupt
+    cpuEnter();
+    canmsg_t * canmsg = sim_device.canReceiveSlot(channel);
+    *canmsg = *msg;
+    canmsg->timestamp = sim_device.rxTimestamp();
+    sim_device.canReceive(channel, canmsg);
+    cpuLeave();
+}
+
+/**
+ * Frame on the bus of given channel is complete
+ *
+ * @param channel Channel index
+ */
+static void busEnd(unsigned char channel) {
+    simchannel_t * chan = &channels[channel];
+    chan->busy = 0;
+
+    if (chan->busy_tx) {
+        sim_stats.transmitted[channel]++;
+        // streamed transmit commands repeat their sequence number
+        if ((hosttx_window > 0) && (memcmp(chan->busy_msg.data, &chan->busy_msg.data[4], 4) != 0))
+            sim_stats.tx_spliced++;
+        cpuEnter();
+        sim_device.txqueue.isr();
+        cpuLeave();
+        if (crosswire && (USBTIN_CHANNELS > 1))
+            receiveFrame(USBTIN_CHANNELS - 1 - channel, &chan->busy_msg);
+        return;
+    }
+
+    receiveFrame(channel, &chan->busy_msg);
+}
+
+/**
+ * Get time of the next engine tick. Ticks are aligned to
+ * CYCLIC_TICK_US and stop at the cutoff like the sources.
+ *
+ * @return Time in ns, NO_EVENT if no tick is due
+ */
+static uint64_t nextTick(void) {
+    const uint64_t tick_ns = CYCLIC_TICK_US * 1000ULL;
+
+    if (!sim_device.tickActive())
+        return NO_EVENT;
+    uint64_t t = tick_last + tick_ns;
+    if (t < now_ns)
+        t = (now_ns + tick_ns - 1) / tick_ns * tick_ns;
+    return (t < cutoff_ns) ? t : NO_EVENT;
+}
+
+/**
+ * Get time of the next event
+ *
+ * @return Time in ns, NO_EVENT if nothing is pending
+ */
+static uint64_t nextEvent(void) {
+    uint64_t t = NO_EVENT;
+    unsigned char channel;
+
+    if ((txcount > 0) && (tx_next < t))
+        t = tx_next;
+    if ((hostpos < hostlen) && (rx_next < t))
+        t = rx_next;
+    if (nextTick() < t)
+        t = nextTick();
+    if (timer_ns < t)
+        t = timer_ns;
+    if (poll_ns && sim_clock.signalled && (poll_next > now_ns) && (poll_next < t))
+        t = poll_next;
+
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        simchannel_t * chan = &channels[channel];
+        if (chan->busy) {
+            if (chan->busy_end < t)
+                t = chan->busy_end;
+        } else if (chan->tx_count > 0) {
+            t = now_ns;
+        } else {
+            int src = nextSource(channel);
+            if (src >= 0) {
+                uint64_t start = source_head[src].time * 1000;
+                if (start < now_ns)
+                    start = now_ns;
+                if (start < t)
+                    t = start;
+            }
+        }
+    }
+    return t;
+}
+
+/**
+ * Advance to the next event and process everything due then
+ *
+ * @param limit Don't advance beyond this time (ns)
+ * @return 1 if an event was processed, 0 if none is due until limit
+ */
+static unsigned char step(uint64_t limit) {
+    uint64_t t = nextEvent();
+    unsigned char channel;
+
+    if (t == NO_EVENT)
+        return 0;
+    if (t > limit) {
+        // a write blocking in the thread may already have gone further
+        if (now_ns < limit) {
+            now_ns = limit;
+            sim_now = now_ns / 1000;
+        }
+        return 0;
+    }
+    now_ns = t;
+    sim_now = now_ns / 1000;
+
+    // serial link, device -> host
+    if ((txcount > 0) && (tx_next <= now_ns)) {
+        hostReceive(txbuf[txhead]);
+        txhead = (txhead + 1) % SIM_SERIAL_TXBUFFER;
+        txcount--;
+        tx_next += byte_ns;
+    }
+
+    // serial link, host -> device; lost characters leave a
+    // PORT_SERIAL_LOST behind like the UART port (UT_serial.cpp)
+    if ((hostpos < hostlen) && (rx_next <= now_ns)) {
+        if (rxgap && (rxcount < SIM_SERIAL_RXBUFFER)) {
+            rxbuf[(rxhead + rxcount) % SIM_SERIAL_RXBUFFER] = PORT_SERIAL_LOST;
+            rxcount++;
+            rxgap = 0;
+        }
+        if (rxcount < SIM_SERIAL_RXBUFFER) {
+            rxbuf[(rxhead + rxcount) % SIM_SERIAL_RXBUFFER] = hostbuf[hostpos];
+            rxcount++;
+        } else {
+            sim_stats.serial_rxoverflow++;
+            rxgap = 1;
+        }
+        hostpos++;
+        rx_next += byte_ns;
+        cpuEnter();
+        sim_device.serialReceived();
+        cpuLeave();
+        sim_clock.signalled = 1;
+    }
+
+    // engine tick interrupt
+    if (nextTick() <= now_ns) {
+        tick_last = now_ns;
+        cpuEnter();
+        sim_device.tick();
+        cpuLeave();
+    }
+
+    // one-shot timer interrupt
+    if (timer_ns <= now_ns) {
+        timer_ns = NO_EVENT;
+        cpuEnter();
+        sim_device.timer();
+        cpuLeave();
+    }
+
+    // CAN buses
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        simchannel_t * chan = &channels[channel];
+        if (chan->busy && (chan->busy_end <= now_ns))
+            busEnd(channel);
+        busStart(channel);
+    }
+
+    return 1;
+}
+
+/**
+ * Run the engine thread if it was signalled and, when polling, its
+ * next pass is due
+ */
+static void thread(void) {
+    if (!sim_clock.signalled)
+        return;
+    if (poll_ns) {
+        if (poll_next > now_ns)
+            return;
+        poll_next = now_ns + poll_ns;
+    }
+    sim_clock.signalled = 0;
+    cpuEnter();
+    sim_device.process();
+    cpuLeave();
+}
+
+/**
+ * Run the simulation up to given time, sources stop producing then
+ *
+ * @param until End time in us
+ */
+void sim_run(uint64_t until) {
+    cutoff_ns = until * 1000;
+
+    while (1) {
+        thread();
+        if (!step(cutoff_ns))
+            return;
+    }
+}
+
+/**
+ * Keep the device running without new source frames until all
+ * buffered frames reached the host
+ */
+void sim_drain(void) {
+    cutoff_ns = now_ns;
+    while (1) {
+        thread();
+        if (!step(NO_EVENT - 1))
+            return;
+    }
+}
+
+/**
+ * Port: read the cycle counter. The simulator counts host nanoseconds.
+ *
+ * @return Nanoseconds of host time
+ */
+uint32_t port_cycles(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+UT_SimClock::UT_SimClock() : signalled(0) {
+}
+
+/**
+ * Start the one-shot timer
+ *
+ * @param delay_us Time until the engine's timer() is called
+ */
+void UT_SimClock::timerStart(uint32_t delay_us) {
+    timer_ns = now_ns + delay_us * 1000ULL;
+}
+
+/**
+ * Send given characters to the host.
+ * Blocks in virtual time while the transmit buffer is full, CAN
+ * interrupts keep being served meanwhile.
+ *
+ * @param buf Characters to send
+ * @param len Count of characters
+ */
+void UT_SimSerial::write(const char * buf, unsigned short len) {
+    while (len > 0) {
+        if (txcount == SIM_SERIAL_TXBUFFER) {
+            cpuLeave();
+            step(NO_EVENT - 1);
+            cpuEnter();
+            continue;
+        }
+        if (txcount == 0)
+            tx_next = now_ns + byte_ns;
+        txbuf[(txhead + txcount) % SIM_SERIAL_TXBUFFER] = *buf++;
+        txcount++;
+        len--;
+    }
+}
+
+/**
+ * Change the link rate once the output has been sent. Both
+ * directions switch at once, the host follows immediately.
+ *
+ * @param baud New baud rate
+ */
+void UT_SimSerial::setBaud(unsigned long baud) {
+    while (txcount > 0) {
+        cpuLeave();
+        step(NO_EVENT - 1);
+        cpuEnter();
+    }
+    byte_ns = 10000000000ULL / baud;
+}
+
+/**
+ * Get received characters in place
+ *
+ * @param data Set to the first character
+ * @param more Set to 1 if further characters follow at the start of the ring
+ * @return Count of contiguous characters, 0 if none was received
+ */
+unsigned short UT_SimSerial::peek(char ** data, unsigned char * more) {
+    unsigned short n = SIM_SERIAL_RXBUFFER - rxhead;
+
+    if (n > rxcount)
+        n = rxcount;
+    *data = &rxbuf[rxhead];
+    *more = rxcount > n;
+    return n;
+}
+
+/**
+ * Release received characters returned by peek()
+ *
+ * @param len Count of characters
+ */
+void UT_SimSerial::consume(unsigned short len) {
+    rxhead = (rxhead + len) % SIM_SERIAL_RXBUFFER;
+    rxcount -= len;
+}
+
+/**
+ * Set bit rate of given channel
+ *
+ * @param channel Channel index
+ * @param hz Bit rate
+ * @return 1 on success
+ */
+unsigned char UT_SimCan::frequency(unsigned char channel, unsigned long hz) {
+    channels[channel].bitrate = hz;
+    return 1;
+}
+
+/**
+ * Go on bus with given channel
+ *
+ * @param channel Channel index
+ * @param mode PORT_CAN_NORMAL or PORT_CAN_LISTEN
+ */
+void UT_SimCan::open(unsigned char channel, unsigned char mode) {
+    channels[channel].open = 1;
+    channels[channel].listen = (mode == PORT_CAN_LISTEN);
+    channels[channel].tx_count = 0;
+}
+
+/**
+ * Go off bus with given channel, pending transmissions are aborted
+ *
+ * @param channel Channel index
+ */
+void UT_SimCan::close(unsigned char channel) {
+    channels[channel].open = 0;
+    channels[channel].tx_count = 0;
+}
+
+/**
+ * Load given frame into a free transmit buffer
+ *
+ * @param channel Channel index
+ * @param canmsg Frame to send
+ * @return 1 if loaded, 0 if no buffer is available
+ */
+unsigned char UT_SimCan::sendFromIsr(unsigned char channel, canmsg_t * canmsg) {
+    simchannel_t * chan = &channels[channel];
+    if (!chan->open || chan->listen || (chan->tx_count >= TX_BUFFERS))
+        return 0;
+    chan->tx[chan->tx_count++] = *canmsg;
+    return 1;
+}
+
+/**
+ * Load the acceptance filter
+ *
+ * @param std Sorted standard id ranges, NULL to accept all frames
+ * @param std_count Count of standard ranges
+ * @param ext Sorted extended id ranges
+ * @param ext_count Count of extended ranges
+ * @return 1 on success
+ */
+unsigned char UT_SimCan::setFilter(const idrange_t * std, unsigned short std_count,
+        const idrange_t * ext, unsigned short ext_count) {
+    filter_all = (std == NULL);
+    if (filter_all)
+        return 1;
+
+    filter_std = (idrange_t *) realloc(filter_std, (std_count + 1) * sizeof(idrange_t));
+    memcpy(filter_std, std, std_count * sizeof(idrange_t));
+    filter_std_count = std_count;
+    filter_ext = (idrange_t *) realloc(filter_ext, (ext_count + 1) * sizeof(idrange_t));
+    memcpy(filter_ext, ext, ext_count * sizeof(idrange_t));
+    filter_ext_count = ext_count;
+    return 1;
+}
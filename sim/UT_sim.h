@@ -0,0 +1,140 @@
+/********************************************************************
+ File: UT_sim.h
+
+ Description:
+ This file contains the simulator definitions. The simulator
+ implements the ports (UT_port.h) of the engine instance sim_device
+ on a workstation with a discrete event model in virtual
+ microseconds:
+
+ - each CAN channel is a bus serializing frames of the traffic
+   sources and frames sent by the device, at the bit rate set with
+   the 'S' command; the device's receive interrupt runs at the end
+   of each frame
+ - the serial link moves one byte per 10 bit times in each direction,
+   the device side has a transmit buffer of SIM_SERIAL_TXBUFFER bytes
+ - the engine thread runs whenever it was signalled; engine code takes
+   no virtual time, its host cpu time is measured instead. With
+   sim_poll() it instead runs every given period while signalled,
+   modelling a main loop that sleeps a fixed time per pass
+
+ With sim_crosswire() the buses of both channels are wired to each
+ other's receiver: frames sent by the device on one channel are also
+ received on the other one (without occupying that bus).
+
+ The host end of the serial link decodes the device's output (ascii
+ or binary) and measures latency from the frame's microsecond
+ timestamp to the arrival of its last byte. It can also stream
+ transmit commands (ascii mode), keeping a window of unanswered
+ commands in flight and resending rejected ones, or upload a trace
+ for the device's replay mode.
+
+ ********************************************************************/
+#ifndef _SIM_
+#define _SIM_
+
+#include <stdint.h>
+
+#include "UT_engine.h"
+#include "UT_simsource.h"
+
+// device serial transmit buffer plus UART fifo
+#ifndef SIM_SERIAL_TXBUFFER
+#define SIM_SERIAL_TXBUFFER (256 + 16)
+#endif
+
+#ifndef SIM_SERIAL_RXBUFFER
+#define SIM_SERIAL_RXBUFFER 256
+#endif
+
+#define SIM_MAXSOURCES 16
+
+typedef struct
+{
+    unsigned long offered[USBTIN_CHANNELS];     // frames sent on the bus by sources
+    unsigned long hwfiltered[USBTIN_CHANNELS];  // frames rejected by the acceptance filter
+    unsigned long transmitted[USBTIN_CHANNELS]; // frames sent by the device
+    unsigned long received;                     // frames decoded by the host
+    unsigned long errors;                       // BELL or error status seen by the host
+    unsigned long tx_acked;                     // transmit commands acknowledged
+    unsigned long tx_rejected;                  // transmit commands answered with BELL
+    unsigned long tx_spliced;                   // streamed frames mixing two commands
+    uint64_t tx_start;                          // first transmit command sent, us
+    uint64_t tx_end;                            // last transmit command acknowledged, us
+    unsigned long long serial_bytes;            // bytes device -> host
+    unsigned long serial_rxoverflow;            // bytes host -> device lost
+    uint64_t busy_us[USBTIN_CHANNELS];          // bus occupied
+    uint64_t cpu_ns;                            // host time spent in engine code
+    unsigned long isotp_pdus;                   // ISO-TP PDUs received by the host
+    unsigned long isotp_bytes;                  // their payload bytes
+    unsigned long isotp_sent;                   // ISO-TP PDUs reported as sent
+    uint64_t isotp_end;                         // last ISO-TP result seen, us
+    uint64_t replay_start;                      // trace upload started, us
+    uint64_t replay_end;                        // replay report seen, us
+    unsigned long replay_sent;                  // replay report: frames sent
+    unsigned long replay_underruns;             // frames uploaded too late
+    unsigned long replay_late_min;              // timing error, us
+    unsigned long replay_late_mean;
+    unsigned long replay_late_max;
+} sim_stats_t;
+
+extern uint64_t sim_now;
+extern sim_stats_t sim_stats;
+
+// simulated CAN buses and controllers
+class UT_SimCan {
+public:
+    unsigned char frequency(unsigned char channel, unsigned long hz);
+    void open(unsigned char channel, unsigned char mode);
+    void close(unsigned char channel);
+    unsigned char sendFromIsr(unsigned char channel, canmsg_t * canmsg);
+    unsigned char setFilter(const idrange_t * std, unsigned short std_count,
+            const idrange_t * ext, unsigned short ext_count);
+};
+
+// device end of the simulated serial link
+class UT_SimSerial {
+public:
+    void write(const char * buf, unsigned short len);
+    unsigned short peek(char ** data, unsigned char * more);
+    void consume(unsigned short len);
+    void setBaud(unsigned long baud);
+};
+
+// virtual time, one-shot timer and the engine thread's wake up
+class UT_SimClock {
+public:
+    UT_SimClock();
+
+    uint32_t micros(void) {
+        return (uint32_t) sim_now;
+    }
+
+    void timerStart(uint32_t delay_us);
+
+    void signal(int32_t signals) {
+        signalled = 1;
+    }
+
+    unsigned char signalled;
+};
+
+typedef UT_Engine<UT_SimCan, UT_SimSerial, UT_SimClock, UT_DefaultConfig> UT_SimEngine;
+
+extern UT_SimEngine sim_device;
+
+void sim_init(unsigned long baud);
+unsigned char sim_addSource(sim_source_t * src);
+void sim_hostSend(const char * buf);
+void sim_hostBinary(void);
+void sim_hostTransmit(unsigned long count, unsigned char window);
+void sim_hostReplay(sim_source_t * src, uint64_t until);
+void sim_crosswire(unsigned char on);
+void sim_poll(uint32_t period_us);
+
+void sim_run(uint64_t until);
+void sim_drain(void);
+
+unsigned long sim_latencies(uint32_t ** samples);
+
+#endif
@@ -0,0 +1,237 @@
+/********************************************************************
+ File: UT_simsource.cpp
+
+ Description:
+ This file contains the simulator traffic source functions.
+
+ ********************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UT_simsource.h"
+
+/**
+ * Get nominal length of given frame on the bus, without stuff bits
+ *
+ * @param msg Frame
+ * @return Bit count including interframe space
+ */
+unsigned long simsource_frameBits(canmsg_t * msg) {
+    unsigned long bits = msg->extended ? 67 : 47;
+    if (!msg->rtr)
+        bits += 8 * ((msg->dlc > 8) ? 8 : msg->dlc);
+    return bits;
+}
+
+/**
+ * Get next pseudo random number (xorshift32)
+ *
+ * @param src Source holding the generator state
+ * @return Random value
+ */
+static uint32_t nextRandom(sim_source_t * src) {
+    uint32_t x = src->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    src->random = x;
+    return x;
+}
+
+/**
+ * Parse optional ":DLC[:CH]" suffix
+ *
+ * @param src Source to set up
+ * @param p Remaining specification
+ * @return 1 on success
+ */
+static unsigned char parseDlcChannel(sim_source_t * src, const char * p) {
+    char * end;
+
+    src->dlc = 8;
+    src->channel = 0;
+    if (*p == 0)
+        return 1;
+    if (*p++ != ':')
+        return 0;
+    src->dlc = strtoul(p, &end, 0);
+    if ((end == p) || (src->dlc > 8))
+        return 0;
+    p = end;
+    if (*p == 0)
+        return 1;
+    if (*p++ != ':')
+        return 0;
+    src->channel = strtoul(p, &end, 0);
+    return (end != p) && (*end == 0);
+}
+
+/**
+ * Set up source from given command line specification
+ *
+ * @param src Source to set up
+ * @param spec Specification, see UT_simsource.h
+ * @param bitrate Bus bit rate, used for load sources
+ * @return 1 on success, 0 on syntax error
+ */
+unsigned char simsource_parse(sim_source_t * src, const char * spec, unsigned long bitrate) {
+    char * end;
+
+    memset(src, 0, sizeof(*src));
+    src->random = 0x12345678;
+
+    if (strncmp(spec, "periodic:", 9) == 0) {
+        src->type = SIMSOURCE_PERIODIC;
+        src->count = 1;
+        src->id = strtoul(spec + 9, &end, 16);
+        if (*end++ != ':')
+            return 0;
+        src->period = strtoull(end, &end, 0);
+        return (src->period > 0) && parseDlcChannel(src, end);
+    }
+
+    if (strncmp(spec, "burst:", 6) == 0) {
+        src->type = SIMSOURCE_BURST;
+        src->id = 0x100;
+        src->count = strtoul(spec + 6, &end, 0);
+        if (*end++ != ':')
+            return 0;
+        src->period = strtoull(end, &end, 0);
+        return (src->count > 0) && (src->period > 0) && parseDlcChannel(src, end);
+    }
+
+    if (strncmp(spec, "load:", 5) == 0) {
+        src->type = SIMSOURCE_LOAD;
+        double percent = strtod(spec + 5, &end);
+        if ((percent <= 0) || !parseDlcChannel(src, end))
+            return 0;
+        canmsg_t msg;
+        msg.extended = 0;
+        msg.rtr = 0;
+        msg.dlc = src->dlc;
+        src->rate = percent / 100.0 * bitrate / simsource_frameBits(&msg) / 1e6;
+        return 1;
+    }
+
+    if (strncmp(spec, "replay:", 7) == 0) {
+        src->type = SIMSOURCE_REPLAY;
+        src->offset = -1;
+        src->file = fopen(spec + 7, "r");
+        return src->file != NULL;
+    }
+
+    return 0;
+}
+
+/**
+ * Read next frame of a candump log
+ *
+ * @param src Replay source
+ * @param frame Output frame
+ * @return 1 if a frame was read, 0 at end of file
+ */
+static unsigned char nextReplay(sim_source_t * src, sim_frame_t * frame) {
+    char line[256];
+
+    while (fgets(line, sizeof(line), src->file)) {
+        unsigned long sec, usec;
+        char iface[32], data[160];
+
+        if (sscanf(line, " (%lu.%lu) %31s %159s", &sec, &usec, iface, data) != 4)
+            continue;
+
+        char * hash = strchr(data, '#');
+        if (hash == NULL)
+            continue;
+        *hash = 0;
+
+        canmsg_t * msg = &frame->msg;
+        msg->id = strtoul(data, NULL, 16);
+        msg->extended = (strlen(data) > 3);
+        msg->rtr = 0;
+        msg->dlc = 0;
+
+        const char * p = hash + 1;
+        if ((*p == 'R') || (*p == 'r')) {
+            msg->rtr = 1;
+            if (p[1] != 0)
+                msg->dlc = strtoul(&p[1], NULL, 16) & 0x0F;
+        } else {
+            while ((msg->dlc < 8) && (p[0] != 0) && (p[1] != 0)) {
+                char byte[3] = { p[0], p[1], 0 };
+                msg->data[msg->dlc++] = strtoul(byte, NULL, 16);
+                p += 2;
+            }
+        }
+
+        int64_t t = (int64_t) sec * 1000000 + usec;
+        if (src->offset < 0)
+            src->offset = t;
+        frame->time = (t > src->offset) ? t - src->offset : 0;
+
+        const char * digit = iface + strlen(iface);
+        while ((digit > iface) && (digit[-1] >= '0') && (digit[-1] <= '9'))
+            digit--;
+        frame->channel = atoi(digit);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Produce next frame of given source
+ *
+ * @param src Source
+ * @param frame Output frame
+ * @return 1 if a frame was produced, 0 if the source is exhausted
+ */
+unsigned char simsource_next(sim_source_t * src, sim_frame_t * frame) {
+    canmsg_t * msg = &frame->msg;
+    unsigned char i;
+
+    if (src->type == SIMSOURCE_REPLAY)
+        return nextReplay(src, frame);
+
+    frame->channel = src->channel;
+    frame->time = src->next;
+
+    msg->id = src->id;
+    if (src->type == SIMSOURCE_LOAD)
+        msg->id = nextRandom(src) & 0x7FF;
+    else if (src->type == SIMSOURCE_BURST)
+        msg->id = src->id + (src->seq % src->count);
+    msg->extended = (msg->id > 0x7FF);
+    msg->rtr = 0;
+    msg->dlc = src->dlc;
+    for (i = 0; i < 8; i++)
+        msg->data[i] = (src->seq >> (8 * (i & 3))) & 0xFF;
+
+    src->seq++;
+    switch (src->type) {
+        case SIMSOURCE_PERIODIC:
+            src->next += src->period;
+            break;
+        case SIMSOURCE_BURST:
+            // all frames of a burst are ready at once, the bus serializes them
+            if ((src->seq % src->count) == 0)
+                src->next += src->period;
+            break;
+        case SIMSOURCE_LOAD:
+            src->next += (uint64_t) (-log((nextRandom(src) + 1.0) / 4294967297.0) / src->rate);
+            break;
+    }
+    return 1;
+}
+
+/**
+ * Release resources of given source
+ *
+ * @param src Source
+ */
+void simsource_close(sim_source_t * src) {
+    if (src->file != NULL)
+        fclose(src->file);
+    src->file = NULL;
+}
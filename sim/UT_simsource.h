@@ -0,0 +1,61 @@
+/********************************************************************
+ File: UT_simsource.h
+
+ Description:
+ This file contains the simulator traffic source definitions.
+ A source produces frames in time order for one channel. Sources are
+ described on the command line:
+
+   periodic:ID:PERIOD_US[:DLC[:CH]]   one id at a fixed period
+   burst:COUNT:PERIOD_US[:DLC[:CH]]   COUNT back-to-back frames per period
+   load:PERCENT[:DLC[:CH]]            random standard ids, Poisson arrivals
+                                      for the given mean bus load
+   replay:FILE                        candump log ("(sec.usec) canN id#data"),
+                                      can0/can1 map to channel 0/1
+
+ IDs above 0x7FF are sent as extended frames.
+
+ ********************************************************************/
+#ifndef _SIMSOURCE_
+#define _SIMSOURCE_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "UT_CANMessage.h"
+
+#define SIMSOURCE_PERIODIC 0
+#define SIMSOURCE_BURST 1
+#define SIMSOURCE_LOAD 2
+#define SIMSOURCE_REPLAY 3
+
+typedef struct
+{
+    uint64_t time;              // earliest start of transmission, us
+    unsigned char channel;
+    canmsg_t msg;
+} sim_frame_t;
+
+typedef struct
+{
+    unsigned char type;         // SIMSOURCE_*
+    unsigned char channel;
+    unsigned long id;
+    unsigned char dlc;
+    unsigned long count;        // frames per burst
+    uint64_t period;            // us
+    double rate;                // load: frames per us
+    FILE * file;                // replay
+    int64_t offset;             // replay: capture time of simulation start, us
+    uint64_t next;              // time of next frame, us
+    unsigned long seq;          // frames produced
+    uint32_t random;            // xorshift state
+} sim_source_t;
+
+unsigned long simsource_frameBits(canmsg_t * msg);
+
+unsigned char simsource_parse(sim_source_t * src, const char * spec, unsigned long bitrate);
+unsigned char simsource_next(sim_source_t * src, sim_frame_t * frame);
+void simsource_close(sim_source_t * src);
+
+#endif
@@ -0,0 +1,317 @@
+/********************************************************************
+ File: usbtin_sim.cpp
+
+ Description:
+ This file contains the command line front end of the simulator.
+ It configures the device over the simulated serial link like a
+ host application would, feeds the traffic sources and reports
+ throughput, drops and latency.
+
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UT_sim.h"
+
+static const unsigned long bitrates[] = {
+    10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000
+};
+
+// start of the measured run, us
+static uint64_t run_start = 0;
+
+/**
+ * Print command line help
+ */
+static void usage(void) {
+    fprintf(stderr,
+        "usage: usbtin_sim [options] [-s SOURCE ...] [-t COUNT]\n"
+        "  -b BAUD     serial link bit rate (default 115200)\n"
+        "  -r BITRATE  CAN bit rate, one of the 'S' command rates (default 500000)\n"
+        "  -d SECONDS  simulated time (default 10)\n"
+        "  -z MODE     time stamping 'Z' mode, latency needs 2 (default 2)\n"
+        "  -c COMMAND  extra command sent before opening, repeatable\n"
+        "  -a COMMAND  extra command sent after opening, repeatable\n"
+        "  -x          wire the buses of both channels to each other\n"
+        "  -B          use binary framing\n"
+        "  -P PERIOD   run the engine every PERIOD us instead of on each interrupt\n"
+        "              (e.g. 1000 for the former 1 ms polling loop)\n"
+        "  -t COUNT    stream COUNT transmit commands on channel 0 (ascii mode)\n"
+        "  -w WINDOW   transmit commands sent ahead of their responses (default 8)\n"
+        "  -p SOURCE   upload the frames of SOURCE within the simulated time to\n"
+        "              the replay ring and replay them (not with -t or -a)\n"
+        "  -s SOURCE   traffic source, repeatable:\n"
+        "              periodic:ID:PERIOD_US[:DLC[:CH]]\n"
+        "              burst:COUNT:PERIOD_US[:DLC[:CH]]\n"
+        "              load:PERCENT[:DLC[:CH]]\n"
+        "              replay:CANDUMP_LOG\n");
+}
+
+/**
+ * Compare latency samples for sorting
+ */
+static int compareLatency(const void * a, const void * b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print the simulation results
+ *
+ * @param duration Simulated time with sources active, us
+ */
+static void report(uint64_t duration) {
+    unsigned long offered = 0;
+    unsigned char channel;
+    double seconds = duration / 1e6;
+
+    printf("simulated %.3f s\n", seconds);
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        volatile rxbuffer_stats_t * stats = &sim_device.rxstats[channel];
+        printf("channel %u: offered %lu, bus load %.1f %%, acceptance filter %lu, transmitted %lu\n",
+            channel, sim_stats.offered[channel], 100.0 * sim_stats.busy_us[channel] / duration,
+            sim_stats.hwfiltered[channel], sim_stats.transmitted[channel]);
+        printf("  rx buffer: dropped full %lu, overrun %lu, highwater %u of %u\n",
+            stats->dropped_full, stats->dropped_overrun, stats->highwater, sim_device.rxsize);
+        printf("  gateway: forwarded %lu, dropped %lu\n",
+            sim_device.gateway.stats[channel].forwarded, sim_device.gateway.stats[channel].dropped);
+        if (sim_device.busstats.enabled) {
+            unsigned short top[5];
+            unsigned short n, i;
+            uint32_t elapsed;
+            unsigned short load;
+            sim_device.busstats.window(channel, &elapsed, &load);
+            printf("  bus statistics: %lu frames in %lu ms, load %.1f %%, top ids",
+                (unsigned long) sim_device.busstats.channels[channel].frames, (unsigned long) elapsed, load / 10.0);
+            n = sim_device.busstats.top(channel, top, 5);
+            for (i = 0; i < n; i++)
+                printf(" %lX:%lu", (unsigned long) (sim_device.busstats.table[top[i]].key & 0x1FFFFFFF),
+                    (unsigned long) (sim_device.busstats.table[top[i]].count - sim_device.busstats.table[top[i]].base));
+            printf("\n");
+        }
+        if (sim_device.ratelimit.count)
+            printf("  rate limiting: decimated %lu\n", sim_device.ratelimit.decimated[channel]);
+        if (sim_device.change.mode)
+            printf("  change-only: suppressed %lu, untracked %lu\n",
+                sim_device.change.suppressed[channel], sim_device.change.untracked[channel]);
+        offered += sim_stats.offered[channel];
+    }
+    printf("software filter rejected %lu\n", sim_device.swfilter.rejected);
+    printf("host: received %lu frames (%.0f/s), errors %lu\n",
+        sim_stats.received, sim_stats.received / seconds, sim_stats.errors);
+    if (sim_stats.isotp_pdus + sim_stats.isotp_sent > 0)
+        printf("host iso-tp: sent %lu, received %lu pdus with %lu bytes, last result after %.1f ms\n",
+            sim_stats.isotp_sent, sim_stats.isotp_pdus, sim_stats.isotp_bytes,
+            (sim_stats.isotp_end - run_start) / 1e3);
+    if (sim_stats.replay_end > 0)
+        printf("host replay: sent %lu, underruns %lu, timing error us min %lu, mean %lu, max %lu, done after %.1f ms\n",
+            sim_stats.replay_sent, sim_stats.replay_underruns, sim_stats.replay_late_min,
+            sim_stats.replay_late_mean, sim_stats.replay_late_max,
+            (sim_stats.replay_end - sim_stats.replay_start) / 1e3);
+    if (sim_stats.tx_acked + sim_stats.tx_rejected > 0) {
+        double tx_seconds = (sim_stats.tx_end - sim_stats.tx_start) / 1e6;
+        printf("host transmit: acknowledged %lu (%.0f/s), rejected %lu, spliced %lu\n",
+            sim_stats.tx_acked, tx_seconds > 0 ? sim_stats.tx_acked / tx_seconds : 0.0,
+            sim_stats.tx_rejected, sim_stats.tx_spliced);
+    }
+    printf("serial: %llu bytes, %.1f bytes/frame, host to device overflow %lu, lines lost %lu\n",
+        sim_stats.serial_bytes,
+        sim_stats.received ? (double) sim_stats.serial_bytes / sim_stats.received : 0.0,
+        sim_stats.serial_rxoverflow, sim_device.sched.stats.input_lost);
+    printf("scheduler: command latency us p50 %u, p90 %u, p99 %u, max %u (%lu passes), frame yields %lu, command yields %lu\n",
+        sim_device.sched.percentile(500), sim_device.sched.percentile(900), sim_device.sched.percentile(990), sim_device.sched.stats.max,
+        sim_device.sched.stats.samples, sim_device.sched.stats.rx_yields, sim_device.sched.stats.cmd_yields);
+
+    uint32_t * samples;
+    unsigned long n = sim_latencies(&samples);
+    if (n > 0) {
+        unsigned long long sum = 0;
+        unsigned long i;
+        qsort(samples, n, sizeof(uint32_t), compareLatency);
+        for (i = 0; i < n; i++)
+            sum += samples[i];
+        printf("latency us: min %u, p50 %u, p99 %u, p99.9 %u, max %u, avg %.1f\n",
+            samples[0], samples[n / 2], samples[n * 99 / 100], samples[n * 999 / 1000],
+            samples[n - 1], (double) sum / n);
+    }
+
+    if (offered > 0)
+        printf("engine host cpu: %.0f ns per offered frame\n",
+            (double) sim_stats.cpu_ns / offered);
+
+#if USBTIN_PERF
+    static const char * const names[PERF_STAGES] = { "can rx", "encode", "flush", "parse", "can tx" };
+    unsigned char stage;
+    for (stage = 0; stage < PERF_STAGES; stage++) {
+        volatile perf_stage_t * s = &sim_device.perf.stages[stage];
+        if (s->count == 0)
+            continue;
+        printf("stage %-6s ns: count %lu, min %u, mean %.0f, max %u\n", names[stage],
+            s->count, s->min, (double) s->sum / s->count, s->max);
+    }
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        volatile perf_counters_t * c = &sim_device.perf.counters[channel];
+        printf("channel %u frames: rx %lu, host %lu, tx %lu, dropped closed %lu, tx full %lu, tx highwater %u\n",
+            channel, c->rx, c->host, c->tx, c->dropped_closed, c->dropped_txfull, c->tx_highwater);
+    }
+#endif
+}
+
+int main(int argc, char ** argv) {
+    static sim_source_t sources[SIM_MAXSOURCES];
+    static sim_source_t upload;
+    const char * upload_spec = NULL;
+    unsigned char source_count = 0;
+    const char * commands[32];
+    unsigned char command_count = 0;
+    const char * after[32];
+    unsigned char after_count = 0;
+    unsigned long baud = 115200;
+    unsigned long bitrate = 500000;
+    double seconds = 10;
+    unsigned char stamping = 2;
+    unsigned char binary = 0;
+    unsigned long txcount = 0;
+    unsigned long window = 8;
+    const char * specs[SIM_MAXSOURCES];
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-B") == 0) {
+            binary = 1;
+            continue;
+        }
+        if (strcmp(arg, "-x") == 0) {
+            sim_crosswire(1);
+            continue;
+        }
+        if ((arg[0] != '-') || (value == NULL)) {
+            usage();
+            return 1;
+        }
+        i++;
+        switch (arg[1]) {
+            case 'b':
+                baud = strtoul(value, NULL, 0);
+                break;
+            case 'r':
+                bitrate = strtoul(value, NULL, 0);
+                break;
+            case 'd':
+                seconds = atof(value);
+                break;
+            case 'z':
+                stamping = atoi(value);
+                break;
+            case 'c':
+                if (command_count < sizeof(commands) / sizeof(commands[0]))
+                    commands[command_count++] = value;
+                break;
+            case 'a':
+                if (after_count < sizeof(after) / sizeof(after[0]))
+                    after[after_count++] = value;
+                break;
+            case 't':
+                txcount = strtoul(value, NULL, 0);
+                break;
+            case 'w':
+                window = strtoul(value, NULL, 0);
+                break;
+            case 'p':
+                upload_spec = value;
+                break;
+            case 'P':
+                sim_poll(strtoul(value, NULL, 0));
+                break;
+            case 's':
+                if (source_count < SIM_MAXSOURCES)
+                    specs[source_count++] = value;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    unsigned char code;
+    for (code = 0; code < sizeof(bitrates) / sizeof(bitrates[0]); code++)
+        if (bitrates[code] == bitrate)
+            break;
+    if ((code == sizeof(bitrates) / sizeof(bitrates[0])) || ((source_count == 0) && (txcount == 0) && (command_count == 0) && (after_count == 0) && (upload_spec == NULL))
+            || (baud == 0) || (window == 0) || (window > 255) || (binary && txcount)
+            || (upload_spec && (binary || txcount || after_count))) {
+        usage();
+        return 1;
+    }
+
+    for (i = 0; i < source_count; i++) {
+        if (!simsource_parse(&sources[i], specs[i], bitrate) || (sources[i].channel >= USBTIN_CHANNELS)) {
+            fprintf(stderr, "invalid source: %s\n", specs[i]);
+            return 1;
+        }
+    }
+
+    if (upload_spec && !simsource_parse(&upload, upload_spec, bitrate)) {
+        fprintf(stderr, "invalid source: %s\n", upload_spec);
+        return 1;
+    }
+
+    // configure and open the channels like a host application
+    char line[LINE_MAXLEN];
+    unsigned char channel;
+    sim_init(baud);
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        snprintf(line, sizeof(line), "%sS%u\r", channel ? "1" : "", code);
+        sim_hostSend(line);
+    }
+    snprintf(line, sizeof(line), "Z%u\r", stamping);
+    sim_hostSend(line);
+    for (i = 0; i < command_count; i++) {
+        snprintf(line, sizeof(line), "%s\r", commands[i]);
+        sim_hostSend(line);
+    }
+    for (channel = 0; channel < USBTIN_CHANNELS; channel++) {
+        snprintf(line, sizeof(line), "%sO\r", channel ? "1" : "");
+        sim_hostSend(line);
+    }
+    if (binary)
+        sim_hostSend("B1\r");
+    sim_run(100000);
+
+    if (binary)
+        sim_hostBinary();
+#if USBTIN_PERF
+    sim_device.perf.clearStages();
+#endif
+    sim_device.sched.clear();
+
+    uint64_t start = sim_now;
+    run_start = start;
+    for (i = 0; i < after_count; i++) {
+        sim_hostSend(after[i]);
+        sim_hostSend("\r");
+    }
+    uint64_t duration = (uint64_t) (seconds * 1e6);
+    for (i = 0; i < source_count; i++)
+        sim_addSource(&sources[i]);
+    if (txcount > 0)
+        sim_hostTransmit(txcount, window);
+    if (upload_spec)
+        sim_hostReplay(&upload, duration);
+    sim_run(start + duration);
+    sim_drain();
+
+    report(duration);
+
+    for (i = 0; i < source_count; i++)
+        simsource_close(&sources[i]);
+    if (upload_spec)
+        simsource_close(&upload);
+    return 0;
+}